@@ -0,0 +1,61 @@
+#include <DMap.hpp>
+#include <iostream>
+#include <numeric>
+
+#define INPUT_SIZE 100000
+#define ITERATIONS 5
+#define THREADS 1
+#define CHUNK_SIZE 0   // 0 => one resident partition per worker, partitions of CHUNK_SIZE items otherwise
+
+struct MyEnv {
+    int step;
+
+    MyEnv(){}
+
+    template <class Archive>
+    void serialize( Archive & ar ){
+        ar(step);
+    }
+};
+
+int main(int argc, char*argv[]){
+    DMap::Exec exec(argc, argv);
+    std::vector<long> input;
+    std::vector<long> output;
+    MyEnv* env = nullptr;
+
+    if (exec.isMaster){
+        // master execution => populate input
+        input = std::vector<long>(INPUT_SIZE);
+        output = std::vector<long>(INPUT_SIZE);
+        std::iota(input.begin(), input.end(), 0);
+        env = new MyEnv();
+    }
+
+    // the input crosses the network just once, then it stays in the workers memory
+    auto data = DMap::scatter(exec, input.begin(), input.end(), CHUNK_SIZE);
+
+    for (int i = 1; i <= ITERATIONS; i++){
+        if (exec.isMaster)
+            env->step = i; // only the (small) environment is sent at each iteration
+
+        auto next = DMap::map(exec, [](long& x, MyEnv* e) -> long { return x + e->step; }, data, env, THREADS);
+        DMap::release(exec, data);
+        data = next;
+    }
+
+    DMap::gather(exec, data, output.begin());
+
+    // if i'm here as master the results are in output, workers have nothing left to do
+    if (exec.isMaster){
+        long expected = ITERATIONS * (ITERATIONS + 1) / 2;
+        for (size_t i = 0; i < output.size(); i++)
+            if (output[i] != (long)i + expected){
+                std::cout << "Wrong result at " << i << std::endl;
+                return 1;
+            }
+        std::cout << "Results are correct" << std::endl;
+    }
+
+    return 0;
+}
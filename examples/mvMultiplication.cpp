@@ -7,6 +7,9 @@
 #define THREADS 1
 #define CHUNK_SIZE 0   // 0 => static sxcheduling, dynamic scheduling otherwise
 
+// the rows travel column by column, delta and varint encoded (see DColumnar)
+template<> struct DColumnar<std::array<int, 3>> : DColumns<int> {};
+
 
 int main(int argc, char*argv[]){
     DMap::Exec exec(argc, argv);
@@ -0,0 +1,35 @@
+#include <DMap.hpp>
+#include <iostream>
+#include <fstream>
+#include <iterator>
+
+#define THREADS 1
+#define CHUNK_SIZE 8   // lines per chunk
+#define WINDOW 4       // out of order chunks the master may buffer
+
+
+int main(int argc, char*argv[]){
+    DMap::Exec exec(argc, argv);
+    std::ifstream in;
+    std::ofstream out;
+
+    if (exec.isMaster){
+        // master execution => open the streams, lines are read and written while the map goes on
+        in.open("examples/input_text.txt");
+        out.open("examples/output_stream.txt");
+    }
+
+    if (DMap::stream_map(exec,
+                 [](std::string& line) -> std::string { for (auto& c : line) c = toupper(c); return line;},
+                 DMap::lines(in),
+                 DMap::ordered(DMap::to(std::ostream_iterator<std::string>(out, "\n")), WINDOW),
+                 CHUNK_SIZE,
+                 (void*) nullptr,
+                 THREADS) < 0){
+        std::cout << "ERROR" << std::endl;
+        return 1;
+    }
+
+    // if i'm here it means that the execution is fine and i'm the master, the output file is already complete
+    return 0;
+}
@@ -6,16 +6,24 @@
 
 #define THREADS 1
 #define CHUNK_SIZE 100   // 0 => static sxcheduling, dynamic scheduling otherwise
+#define FILE_INPUT 0     // 1 => workers read the input file by themselves (shared filesystem), the master loads it otherwise
+#define FILE_OUTPUT 0    // 1 => workers write the output file by themselves (shared filesystem), the master collects it otherwise
 
 
 int main(int argc, char*argv[]){
     DMap::Exec exec(argc, argv);
     std::string input;
     std::string output;
+    auto inputFile = DMap::file<char>("examples/input_text.txt");
+    auto toUpper = [](char& c) -> char { return  toupper(c);};
     //MyEnv* env = nullptr;
     if (exec.isMaster){
         // master execution => populate input
 
+#if FILE_INPUT
+        // the workers read the file, the master only needs to know its size
+        output = std::string(inputFile.items(), 0);
+#else
         std::ifstream f("examples/input_text.txt"); //taking file as inputstream
 
        if(f) {
@@ -26,25 +34,38 @@ int main(int argc, char*argv[]){
 
 
        output = std::string(input.size(), 0);
+#endif
     }
 
+#if FILE_OUTPUT
+    auto out = DMap::output_file<char>("examples/output_text.txt");
+#else
+    auto out = output.begin();
+#endif
+
+#if FILE_INPUT
+    if (DMap::map(exec, toUpper, inputFile, out, CHUNK_SIZE, (void*) nullptr, THREADS) < 0){
+#else
         // note the abolute primitive in lambda function and a scaling of 1000 which results in items of computation time limited to 50ms
     if (DMap::map(exec,
-                 [](char& c) -> char { return  toupper(c);}, 
+                 toUpper, 
                  input.begin(), 
                  input.end(), 
-                 output.begin(), 
+                 out, 
                  CHUNK_SIZE, 
                  (void*) nullptr, 
                  THREADS) < 0){
+#endif
         std::cout << "ERROR" << std::endl;
         return 1;
     }
 
     // if i'm here it means that the execution is fine and i'm the master so i can consume the results
 
-    std::ofstream out("examples/output_text.txt");
-    out << output;
-    out.close();
+#if !FILE_OUTPUT
+    std::ofstream f("examples/output_text.txt");
+    f << output;
+    f.close();
+#endif
     return 0;
 }
\ No newline at end of file
@@ -2,26 +2,66 @@
 #include <iterator>
 #include <vector>
 #include <sstream>
+#include <type_traits>
+#include <sys/stat.h>
+#include <csignal>
+#include <sys/wait.h>
+#include <dirent.h>
+#include <algorithm>
+#include <memory>
+#include <array>
+#include <DMapConfig.hpp>
 #include <DMapMaster.hpp>
+#include <DMapStreamMaster.hpp>
 #include <DMapWorker.hpp>
+#include <DMapSubMaster.hpp>
 
 namespace DMap {
 
-struct Exec {
+struct Exec : public DMapConfig {
     bool isMaster;
+    bool isSub = false; // node-local sub-master (see DMapSubMaster)
     std::string masterAddr;
     std::vector<std::string> workers_addrs;
+    std::string localAddr;                  // (sub-master only) listen address for the results of the local workers
+    std::vector<std::string> localWorkers;  // (sub-master only) the local workers
+    std::vector<pid_t> children;            // (local launcher only) the worker processes forked by the master
+    std::vector<int> channels;              // (local launcher only) own ends of the socketpairs, each map works on duplicates
 
     Exec(int argc, char*argv[]){
         if (argc == 1){
-            ff::error("Usage: exec true exec true <Listen address> <Worker address> ... \n          OR: exec false <Listen address> <Master address> ");
+            ff::error("Usage: exec true exec true <Listen address> <Worker address> ... \n          OR: exec false <Listen address> <Master address> [<cpu map>]\n          OR: exec sub <Listen address> <Master address> <Local listen address> <Local worker address> ...\n          OR: exec local <Number of workers>");
             exit(EXIT_FAILURE);
         }
+
+        if (std::string(argv[1]) == "local"){
+            if (argc != 3 || std::atoi(argv[2]) <= 0){
+                ff::error("Usage: exec local <Number of workers>");
+                exit(EXIT_FAILURE);
+            }
+            launchLocal(std::atoi(argv[2]));
+            return;
+        }
         
+        isSub = (std::string(argv[1]) == "sub");
         std::istringstream(argv[1]) >> std::boolalpha >> isMaster;
+        if (isSub) isMaster = false;
 
-        if (isMaster){
-            if (argc < 4){
+        if (isSub){
+            // to the master it is a worker listening on workers_addrs[0], to the local workers it is the master
+            if (argc < 6){
+                ff::error("Usage: exec sub <Listen address> <Master address> <Local listen address> <Local worker address> ...");
+                exit(EXIT_FAILURE);
+            }
+            workers_addrs.push_back(std::string(argv[2]));
+            masterAddr = std::string(argv[3]);
+            localAddr = std::string(argv[4]);
+            for(int i = 5; i < argc; i++)
+                localWorkers.push_back(std::string(argv[i]));
+
+        } else if (isMaster){
+            // with no worker the map must be elastic (workers join by themselves)
+            if (argc < 3){
                 ff::error("Usage: exec true <Listen address> <Worker address> ...");
                 exit(EXIT_FAILURE);
             }
@@ -30,35 +70,680 @@ struct Exec {
                 workers_addrs.push_back(std::string(argv[i]));
 
         } else {
-            if (argc!=4){
-                ff::error("Usage: exec false <Listen address> <Master address>");
+            if (argc!=4 && argc!=5){
+                ff::error("Usage: exec false <Listen address> <Master address> [<receiver cpu>,<sender cpu>,<compute cpu>,...]");
                 exit(EXIT_FAILURE);
             }
             workers_addrs.push_back(std::string(argv[2]));
             masterAddr = std::string(argv[3]);
+            if (argc == 5)
+                cpuMap = parseCpuList(std::string(argv[4]));
         }
     }
 
     Exec() = default;
+
+    /*
+        The master waits for the worker processes it forked
+    */
+    ~Exec(){
+        for (int fd : channels)
+            close(fd);
+        for (pid_t child : children)
+            waitpid(child, nullptr, 0);
+    }
+
+private:
+    /*
+        Local launcher: fork n worker processes, connected to the master through two socketpairs each (master -> worker, worker -> master),
+        so nothing is listened on or connected to and the startup does not depend on retries. In the worker, its ends of the socketpairs are
+        moved to the same descriptor numbers as the master ends, so the "fd:<n>" address of a channel is the same in both processes.
+        The parent returns as the master, each child as a worker.
+    */
+    void launchLocal(size_t n){
+        std::vector<std::array<int, 2>> down(n), up(n);
+        for (size_t i = 0; i < n; i++)
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, down[i].data()) < 0 || socketpair(AF_UNIX, SOCK_STREAM, 0, up[i].data()) < 0){
+                ff::error("Error creating the socketpairs of the local workers");
+                exit(EXIT_FAILURE);
+            }
+
+        for (size_t i = 0; i < n; i++){
+            pid_t pid = fork();
+            if (pid < 0){
+                ff::error("Error forking the local workers");
+                exit(EXIT_FAILURE);
+            }
+
+            if (pid == 0){
+                // keep just the own channels, at the descriptor numbers of the master ends
+                for (size_t j = 0; j < n; j++)
+                    if (j != i)
+                        for (int fd : {down[j][0], down[j][1], up[j][0], up[j][1]})
+                            close(fd);
+                dup2(down[i][1], down[i][0]); close(down[i][1]);
+                dup2(up[i][1], up[i][0]); close(up[i][1]);
+
+                isMaster = false;
+                workers_addrs = {"fd:" + std::to_string(down[i][0])};
+                masterAddr = "fd:" + std::to_string(up[i][0]);
+                channels = {down[i][0], up[i][0]};
+                children.clear();
+                return;
+            }
+            children.push_back(pid);
+        }
+
+        isMaster = true;
+        masterAddr = "fd:";
+        for (size_t i = 0; i < n; i++){
+            close(down[i][1]);
+            close(up[i][1]);
+            channels.push_back(down[i][0]);
+            channels.push_back(up[i][0]);
+            workers_addrs.push_back("fd:" + std::to_string(down[i][0]));
+            masterAddr += (i ? "," : "") + std::to_string(up[i][0]);
+        }
+    }
 };
 
+/*
+    Type returned by the user function, which may or may not take the environment pointer
+*/
+template<typename Function, typename Tin, typename Env>
+using result_t = typename std::conditional_t<std::is_invocable_v<Function, Tin&>, std::invoke_result<Function, Tin&>, std::invoke_result<Function, Tin&, Env*>>::type;
+
+/*
+    Worker side of every map flavour: run the worker pipeline until the master sends the EOS, then terminate the process.
+    If resident datasets are involved the process stays alive, since the next DMap calls of the program will use them.
+*/
+template<typename Tin, typename Tout, typename Env, typename Function>
+void runWorker(Exec& execEnv, Function f, int wth, ssize_t inputDataset = -1, ssize_t outputDataset = -1){
+    // a sub-master just relays the chunks between the master and its local workers
+    if (execEnv.isSub){
+        if (inputDataset >= 0 || outputDataset >= 0){
+            ff::error("Resident datasets are not supported through a sub-master");
+            exit(EXIT_FAILURE);
+        }
+        DMapSubMaster<Tin, Tout, Env> s(execEnv.workers_addrs[0], execEnv.masterAddr, execEnv.localAddr, execEnv.localWorkers, execEnv);
+        if (s.run_and_wait_end() < 0){
+            ff::error("Error executing sub-master");
+            exit(EXIT_FAILURE);
+        }
+        exit(EXIT_SUCCESS);
+    }
+
+    // elastic map: SIGUSR1 lets the worker leave once its current chunks are done
+    if (execEnv.elastic){
+        leaveRequested();
+        signal(SIGUSR1, [](int){ leaveRequested() = true; });
+    }
+
+    DMapWorker<Tin, Tout, Env> w(f, execEnv.workers_addrs[0], execEnv.masterAddr, wth, execEnv);
+    w.setResidentDatasets(inputDataset, outputDataset);
+    
+    if (w.run_and_wait_end() < 0){
+        ff::error("Error executing worker");
+        exit(EXIT_FAILURE);
+    }
+
+    if (inputDataset < 0 && outputDataset < 0)
+        exit(EXIT_SUCCESS);
+}
+
 template<typename InputIterator, typename OutputIterator, typename Function, typename Env = void>
 int map(Exec& execEnv, Function f, InputIterator begin_in, InputIterator end_in, OutputIterator begin_out, size_t chunk_size = 0, Env* env = nullptr, int wth = FF_AUTO){
     typedef typename std::iterator_traits<InputIterator>::value_type Tin;
     typedef typename  std::iterator_traits<OutputIterator>::value_type Tout;
     if (execEnv.isMaster){
-        DMapMaster m(execEnv.masterAddr, execEnv.workers_addrs, begin_in, end_in, begin_out, env, chunk_size);
+        DMapMaster m(execEnv.masterAddr, execEnv.workers_addrs, begin_in, end_in, begin_out, env, chunk_size, execEnv);
+        if (execEnv.masterThreads > 0)
+            m.setLocalWorker(f, execEnv.masterThreads);
         return m.run_and_wait_end();
-    } else {
-        DMapWorker<Tin, Tout, Env> w(f, execEnv.workers_addrs[0], execEnv.masterAddr, wth);
-        
-        if (w.run_and_wait_end() < 0){
-            ff::error("Error executing worker");
-            exit(EXIT_FAILURE);
+    } else
+        runWorker<Tin, Tout, Env>(execEnv, f, wth);
+    return 0;
+}
+
+/*
+    Estimator of the cost of an item, in any unit: cost(const Tin&) -> number
+*/
+template<typename Cost>
+struct CostHint {
+    Cost cost;
+};
+
+template<typename Cost>
+CostHint<Cost> cost_hint(Cost cost){ return CostHint<Cost>{cost}; }
+
+/*
+    Prefix sum of the estimated costs of [begin_in, end_in) (items + 1 entries), computed in parallel: every block of the input is scanned
+    by its own thread, then each block is shifted by the total of the blocks before it. Negative estimates count as 0.
+*/
+template<typename InputIterator, typename Cost>
+std::vector<double> prefixCosts(InputIterator begin_in, InputIterator end_in, Cost cost){
+    size_t n = std::distance(begin_in, end_in);
+    std::vector<double> prefix(n + 1, 0);
+    long blocks = std::max<long>(1, std::min<long>(ff_numCores(), n / 4096));
+    std::vector<double> offset(blocks + 1, 0);
+
+    ff::ParallelFor pf(blocks);
+    pf.parallel_for(0, blocks, [&](const long b){
+        size_t first = n * b / blocks, last = n * (b + 1) / blocks;
+        InputIterator it = std::next(begin_in, first);
+        double sum = 0;
+        for (size_t i = first; i < last; i++, ++it){
+            sum += std::max(0.0, (double)cost(*it));
+            prefix[i + 1] = sum;
         }
+        offset[b + 1] = sum;
+    });
+    for (long b = 1; b <= blocks; b++)
+        offset[b] += offset[b - 1];
+    pf.parallel_for(1, blocks, [&](const long b){
+        for (size_t i = n * b / blocks; i < n * (b + 1) / blocks; i++)
+            prefix[i + 1] += offset[b];
+    });
+    return prefix;
+}
 
-        exit(EXIT_SUCCESS);
+/*
+    Static scheduling with blocks of equal estimated work instead of equal size: one message per worker, balanced as far as the cost
+    estimator is right. The master computes the estimates before the map starts.
+*/
+template<typename InputIterator, typename OutputIterator, typename Function, typename Cost, typename Env = void>
+int map(Exec& execEnv, Function f, InputIterator begin_in, InputIterator end_in, OutputIterator begin_out, const CostHint<Cost>& hint, Env* env = nullptr, int wth = FF_AUTO){
+    typedef typename std::iterator_traits<InputIterator>::value_type Tin;
+    typedef typename  std::iterator_traits<OutputIterator>::value_type Tout;
+    if (execEnv.isMaster){
+        DMapMaster m(execEnv.masterAddr, execEnv.workers_addrs, begin_in, end_in, begin_out, env, 0, execEnv);
+        m.setCosts(prefixCosts(begin_in, end_in, hint.cost));
+        if (execEnv.masterThreads > 0)
+            m.setLocalWorker(f, execEnv.masterThreads);
+        return m.run_and_wait_end();
+    } else
+        runWorker<Tin, Tout, Env>(execEnv, f, wth);
+    return 0;
+}
+
+/*
+    Input file of records of type T, read directly by the workers (they must see the same path, e.g. on a shared filesystem)
+*/
+template<typename T>
+struct File {
+    DFileRange range;
+
+    size_t items() const { return range.items; }
+};
+
+/*
+    Describe the file at path, skipping offset bytes. The number of records is the remaining size divided by sizeof(T).
+*/
+template<typename T>
+File<T> file(const std::string& path, size_t offset = 0){
+    static_assert(std::is_trivially_copyable<T>::value, "File input requires trivially copyable records");
+    File<T> f;
+    f.range.path = path;
+    f.range.offset = offset;
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0 && (size_t)st.st_size > offset)
+        f.range.items = (st.st_size - offset) / sizeof(T);
+    return f;
+}
+
+/*
+    Segment files of the output file at path (see segmentPath), sorted in input order. Only names made of path, a dot and the
+    20 digits of an index are segments, so other files sharing the prefix (e.g. path.bak) are not picked up. -1 if the directory
+    cannot be read.
+*/
+inline int segmentFiles(const std::string& path, std::vector<std::string>& segments){
+    std::string dir = ".", base = path;
+    if (path.find('/') != std::string::npos){
+        dir = path.substr(0, path.rfind('/'));
+        base = path.substr(path.rfind('/') + 1);
     }
+
+    segments.clear();
+    DIR* d = opendir(dir.c_str());
+    if (!d) return -1;
+    while (struct dirent* e = readdir(d)){
+        std::string name(e->d_name);
+        if (name.size() == base.size() + 21 && name.compare(0, base.size() + 1, base + ".") == 0
+            && std::all_of(name.begin() + base.size() + 1, name.end(), [](char c){ return c >= '0' && c <= '9'; }))
+            segments.push_back(dir + "/" + name);
+    }
+    closedir(d);
+    std::sort(segments.begin(), segments.end()); // zero padded indexes => input order
+    return 0;
+}
+
+/*
+    Output file of records of type T, written directly by the workers (they must see the same path, e.g. on a shared filesystem).
+    Trivially copyable results are written at offset + index*sizeof(T); other results go to one segment file per chunk (see load_segments).
+*/
+template<typename T>
+struct OutputFile {
+    DFileRange range;
+
+    /*
+        Create (or truncate) the file, sized for the given number of records. Segments left by a previous map are removed, since
+        their chunks may not match the ones of this map.
+    */
+    int create(size_t items) const {
+        if constexpr (std::is_trivially_copyable<T>::value){
+            int fd = open(range.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0 || ftruncate(fd, range.offset + items * sizeof(T)) < 0){
+                ff::error("Error creating the output file %s\n", range.path.c_str());
+                if (fd >= 0) close(fd);
+                return -1;
+            }
+            close(fd);
+        } else {
+            std::vector<std::string> segments;
+            segmentFiles(range.path, segments);
+            for (const auto& name : segments)
+                if (unlink(name.c_str()) < 0){
+                    ff::error("Error removing the old segment %s\n", name.c_str());
+                    return -1;
+                }
+        }
+        return 0;
+    }
+};
+
+template<typename T>
+OutputFile<T> output_file(const std::string& path, size_t offset = 0){
+    OutputFile<T> f;
+    f.range.path = path;
+    f.range.offset = offset;
+    return f;
+}
+
+/*
+    Read back, in input order, the results that the workers stored into segment files (results that are not trivially copyable)
+*/
+template<typename T, typename OutputIterator>
+int load_segments(const std::string& path, OutputIterator out){
+    std::vector<std::string> segments;
+    if (segmentFiles(path, segments) < 0)
+        return -1;
+    for (const auto& name : segments){
+        std::ifstream segment(name, std::ios::binary);
+        cereal::PortableBinaryInputArchive iarchive(segment);
+        std::vector<T, default_init_allocator<T>> data;
+        iarchive >> data;
+        out = std::move(data.begin(), data.end(), out);
+    }
+    return 0;
+}
+
+/*
+    Map over a file: the master sends only (range) descriptors and each worker reads its own records, so the input is never loaded on the master
+*/
+template<typename T, typename OutputIterator, typename Function, typename Env = void>
+int map(Exec& execEnv, Function f, const File<T>& input, OutputIterator begin_out, size_t chunk_size = 0, Env* env = nullptr, int wth = FF_AUTO){
+    typedef typename  std::iterator_traits<OutputIterator>::value_type Tout;
+    if (execEnv.isMaster){
+        DPlacement placement;
+        placement.inputFile = &input.range;
+        placement.items = input.items();
+        DMapMaster<const T*, OutputIterator, Env> m(execEnv.masterAddr, execEnv.workers_addrs, nullptr, nullptr, begin_out, placement, env, chunk_size, execEnv);
+        return m.run_and_wait_end();
+    } else
+        runWorker<T, Tout, Env>(execEnv, f, wth);
     return 0;
 }
+
+/*
+    Map writing to a file: each worker writes its own results, the master receives only acknowledgements and never holds the output
+*/
+template<typename InputIterator, typename T, typename Function, typename Env = void>
+int map(Exec& execEnv, Function f, InputIterator begin_in, InputIterator end_in, const OutputFile<T>& output, size_t chunk_size = 0, Env* env = nullptr, int wth = FF_AUTO){
+    typedef typename std::iterator_traits<InputIterator>::value_type Tin;
+    if (execEnv.isMaster){
+        if (output.create(std::distance(begin_in, end_in)) < 0)
+            return -1;
+        DPlacement placement;
+        placement.outputFile = &output.range;
+        DMapMaster<InputIterator, T*, Env> m(execEnv.masterAddr, execEnv.workers_addrs, begin_in, end_in, nullptr, placement, env, chunk_size, execEnv);
+        return m.run_and_wait_end();
+    } else
+        runWorker<Tin, T, Env>(execEnv, f, wth);
+    return 0;
+}
+
+/*
+    Map from a file to a file: neither the input nor the output cross the network
+*/
+template<typename Tin, typename Tout, typename Function, typename Env = void>
+int map(Exec& execEnv, Function f, const File<Tin>& input, const OutputFile<Tout>& output, size_t chunk_size = 0, Env* env = nullptr, int wth = FF_AUTO){
+    if (execEnv.isMaster){
+        if (output.create(input.items()) < 0)
+            return -1;
+        DPlacement placement;
+        placement.inputFile = &input.range;
+        placement.outputFile = &output.range;
+        placement.items = input.items();
+        DMapMaster<const Tin*, Tout*, Env> m(execEnv.masterAddr, execEnv.workers_addrs, nullptr, nullptr, nullptr, placement, env, chunk_size, execEnv);
+        return m.run_and_wait_end();
+    } else
+        runWorker<Tin, Tout, Env>(execEnv, f, wth);
+    return 0;
+}
+
+/*
+    Handle of a dataset whose partitions are resident in the memory of the workers, across map calls.
+    Every process of the program gets the same handle (same id) from the same call; only the master knows where the partitions are.
+*/
+template<typename T>
+struct Dataset {
+    size_t id;
+    size_t items = 0;
+    std::vector<DPartition> partitions;
+    std::shared_ptr<std::vector<T>> copy; // master copy of the data (if kept), which lets the scheduler move partitions between workers
+};
+
+template<typename T>
+T identity(T& item){ return item; }
+
+/*
+    Ship the items [begin_in, end_in) to the workers once. Partitions are one block per worker (chunk_size == 0 or CHUNK_AUTO) or chunks of chunk_size
+    assigned round robin, and they stay in the worker memory until released.
+    With keepCopy the master keeps a copy of the data, so the first map over the dataset can balance the load by moving partitions.
+*/
+template<typename InputIterator>
+Dataset<typename std::iterator_traits<InputIterator>::value_type> scatter(Exec& execEnv, InputIterator begin_in, InputIterator end_in, size_t chunk_size = 0, bool keepCopy = false){
+    typedef typename std::iterator_traits<InputIterator>::value_type T;
+    Dataset<T> ds;
+    ds.id = newDatasetId();
+    if (execEnv.isMaster){
+        ds.items = std::distance(begin_in, end_in);
+        ds.partitions = makePartitions(ds.items, execEnv.workers_addrs.size(), chunk_size == CHUNK_AUTO ? 0 : chunk_size);
+
+        DPlacement placement;
+        placement.partitions = &ds.partitions;
+        placement.residentOutput = true;
+        DMapMaster<InputIterator, T*, void> m(execEnv.masterAddr, execEnv.workers_addrs, begin_in, end_in, nullptr, placement, nullptr, 0, execEnv);
+        if (m.run_and_wait_end() < 0)
+            ff::error("Error scattering the dataset\n");
+        if (keepCopy)
+            ds.copy = std::make_shared<std::vector<T>>(begin_in, end_in);
+    } else
+        runWorker<T, T, void>(execEnv, identity<T>, 1, -1, ds.id);
+    return ds;
+}
+
+/*
+    Map over a resident dataset: the master sends only the ranges (and the environment), each worker computes the partitions it holds
+    and keeps the results, which form a new resident dataset with the same partitioning.
+*/
+template<typename Tin, typename Function, typename Env = void>
+auto map(Exec& execEnv, Function f, const Dataset<Tin>& input, Env* env = nullptr, int wth = FF_AUTO){
+    typedef result_t<Function, Tin, Env> Tout;
+    Dataset<Tout> ds;
+    ds.id = newDatasetId();
+    if (execEnv.isMaster){
+        ds.items = input.items;
+        ds.partitions = input.partitions;
+
+        DPlacement placement;
+        placement.partitions = &ds.partitions; // partitions moved by the scheduler are owned by their new worker in the output dataset
+        placement.residentInput = placement.residentOutput = true;
+        placement.cachedInput = (bool)input.copy;
+        placement.items = input.items;
+        const Tin* begin_in = input.copy ? input.copy->data() : nullptr;
+        const Tin* end_in = input.copy ? input.copy->data() + input.copy->size() : nullptr;
+        DMapMaster<const Tin*, Tout*, Env> m(execEnv.masterAddr, execEnv.workers_addrs, begin_in, end_in, nullptr, placement, env, 0, execEnv);
+        if (m.run_and_wait_end() < 0)
+            ff::error("Error mapping the resident dataset\n");
+    } else
+        runWorker<Tin, Tout, Env>(execEnv, f, wth, input.id, ds.id);
+    return ds;
+}
+
+/*
+    Collect a resident dataset on the master, writing it starting from begin_out
+*/
+template<typename T, typename OutputIterator>
+int gather(Exec& execEnv, const Dataset<T>& input, OutputIterator begin_out){
+    if (execEnv.isMaster){
+        std::vector<DPartition> partitions = input.partitions;
+        DPlacement placement;
+        placement.partitions = &partitions;
+        placement.residentInput = true;
+        placement.items = input.items;
+        DMapMaster<const T*, OutputIterator, void> m(execEnv.masterAddr, execEnv.workers_addrs, nullptr, nullptr, begin_out, placement, nullptr, 0, execEnv);
+        return m.run_and_wait_end();
+    } else
+        runWorker<T, T, void>(execEnv, identity<T>, 1, input.id, -1);
+    return 0;
+}
+
+/*
+    Free the memory of a resident dataset. No communication is needed, every process drops its own partitions.
+*/
+template<typename T>
+void release(Exec& execEnv, Dataset<T>& ds){
+    if (!execEnv.isMaster)
+        DResidentStore::instance().release(ds.id);
+    ds.partitions.clear();
+    ds.copy.reset();
+}
+
+/*
+    Sources for the streaming map: objects exposing value_type and bool operator()(value_type&), which returns false once the stream is over
+*/
+template<typename InputIterator>
+struct IteratorSource {
+    typedef typename std::iterator_traits<InputIterator>::value_type value_type;
+    InputIterator it, end;
+
+    bool operator()(value_type& item){
+        if (it == end) return false;
+        item = *it;
+        ++it;
+        return true;
+    }
+};
+
+struct LineSource {
+    typedef std::string value_type;
+    std::istream* is;
+
+    bool operator()(std::string& line){
+        return (bool)std::getline(*is, line);
+    }
+};
+
+template<typename T, typename Generator>
+struct GeneratorSource {
+    typedef T value_type;
+    Generator g;
+
+    bool operator()(T& item){
+        return g(item);
+    }
+};
+
+// stream the items of a (possibly single pass) iterator range, e.g. std::istream_iterator
+template<typename InputIterator>
+IteratorSource<InputIterator> from(InputIterator begin, InputIterator end){ return {begin, end}; }
+
+// stream the lines of an input stream
+inline LineSource lines(std::istream& is){ return {&is}; }
+
+// stream the items produced by a callable bool(T&)
+template<typename T, typename Generator>
+GeneratorSource<T, Generator> generate(Generator g){ return {std::move(g)}; }
+
+/*
+    Sink writing every result to an output iterator (e.g. std::ostream_iterator, std::back_inserter), in the order results are delivered
+*/
+template<typename OutputIterator>
+struct IteratorSink {
+    OutputIterator out;
+
+    template<typename T>
+    void operator()(size_t, T& item){
+        *out++ = std::move(item);
+    }
+};
+
+template<typename OutputIterator>
+IteratorSink<OutputIterator> to(OutputIterator out){ return {out}; }
+
+/*
+    Deliver the results to sink in input order, buffering at most window out of order chunks on the master
+*/
+template<typename Sink>
+OrderedSink<Sink> ordered(Sink sink, size_t window = 64){ return {std::move(sink), window ? window : 1}; }
+
+/*
+    Source reading the records of a File window by window, so that at most windowItems records are in memory.
+    The file is opened at the first read. If it cannot be opened or read the stream ends there and failed is set.
+*/
+template<typename T>
+struct RecordSource {
+    typedef T value_type;
+    DFileRange range;
+    size_t windowItems;
+    std::shared_ptr<std::ifstream> is;
+    std::vector<T, default_init_allocator<T>> window;
+    size_t pos = 0;
+    std::shared_ptr<bool> failed = std::make_shared<bool>(false);
+
+    bool operator()(T& item){
+        if (pos == window.size()){
+            pos = 0;
+            window.clear();
+            if (*failed) return false;
+            if (!is){
+                is = std::make_shared<std::ifstream>(range.path, std::ios::binary);
+                if (!*is || !is->seekg(range.offset)){
+                    ff::error("Error opening the input file %s\n", range.path.c_str());
+                    *failed = true;
+                    return false;
+                }
+            }
+            window.resize(windowItems);
+            is->read((char*)window.data(), windowItems * sizeof(T));
+            window.resize(is->gcount() / sizeof(T));
+            if (is->bad() || (!*is && !is->eof())){
+                ff::error("Error reading the input file %s\n", range.path.c_str());
+                window.clear();
+                *failed = true;
+                return false;
+            }
+            if (window.empty()) return false;
+        }
+        item = window[pos++];
+        return true;
+    }
+};
+
+/*
+    Sink spilling results to an OutputFile: contiguous results are accumulated (at most bufferItems of them) and written with a single pwrite
+    as soon as the run is interrupted or the buffer is full. The last run is written by an explicit flush once the stream is over.
+    A failed open or write is reported once, sets failed and discards the following results.
+*/
+template<typename T>
+struct RecordSink {
+    struct spill {
+        DFileRange range;
+        int fd = -1;
+        size_t bufferItems, bufferBegin = 0;
+        std::vector<T> buffer;
+        bool failed = false;
+
+        void flush(){
+            if (buffer.empty()) return;
+            if (!failed && fd < 0 && (fd = open(range.path.c_str(), O_WRONLY)) < 0){
+                ff::error("Error opening the output file %s\n", range.path.c_str());
+                failed = true;
+            }
+
+            const char* ptr = (const char*)buffer.data();
+            size_t len = buffer.size() * sizeof(T);
+            off_t off = range.offset + bufferBegin * sizeof(T);
+            while (!failed && len > 0){
+                ssize_t w = pwrite(fd, ptr, len, off);
+                if (w <= 0){
+                    ff::error("Error writing the output file %s\n", range.path.c_str());
+                    failed = true;
+                    break;
+                }
+                ptr += w; off += w; len -= w;
+            }
+            buffer.clear();
+        }
+
+        ~spill(){
+            flush();
+            if (fd >= 0) close(fd);
+        }
+    };
+    std::shared_ptr<spill> state;
+
+    void operator()(size_t index, T& item){
+        spill& s = *state;
+        if (!s.buffer.empty() && (index != s.bufferBegin + s.buffer.size() || s.buffer.size() == s.bufferItems))
+            s.flush();
+        if (s.buffer.empty()){
+            s.bufferBegin = index;
+            s.buffer.reserve(s.bufferItems);
+        }
+        s.buffer.push_back(std::move(item));
+    }
+};
+
+/*
+    Streaming map: the input is pulled from source while the computation goes on (its length does not need to be known),
+    and every result is passed to sink(index in the stream, result) as soon as its chunk comes back from a worker.
+    The master only keeps the chunks in flight in memory. Since the stream length is unknown, chunk_size == 0 (or CHUNK_AUTO) selects DEFAULT_STREAM_CHUNK.
+*/
+template<typename Source, typename Sink, typename Function, typename Env = void>
+int stream_map(Exec& execEnv, Function f, Source source, Sink sink, size_t chunk_size = 0, Env* env = nullptr, int wth = FF_AUTO){
+    typedef typename Source::value_type Tin;
+    typedef result_t<Function, Tin, Env> Tout;
+    if (execEnv.isMaster){
+        DMapStreamMaster<Tin, Tout, Source, Sink, Env> m(execEnv.masterAddr, execEnv.workers_addrs, std::move(source), std::move(sink), env, chunk_size, execEnv);
+        return m.run_and_wait_end();
+    } else
+        runWorker<Tin, Tout, Env>(execEnv, f, wth);
+    return 0;
+}
+
+/*
+    Out of core map for datasets larger than the master memory: the input file is read by the master in windows as chunks are dispatched and the
+    results are spilled to the output file as they complete. The data held by the master stays within execEnv.memoryBudget bytes: chunks in flight
+    take what they need, the rest is split between the input window and the output buffer. On the master it returns -1 if the input
+    could not be read or the output could not be written.
+*/
+template<typename Tin, typename Tout, typename Function, typename Env = void>
+int out_of_core_map(Exec& execEnv, Function f, const File<Tin>& input, const OutputFile<Tout>& output, size_t chunk_size = 0, Env* env = nullptr, int wth = FF_AUTO){
+    static_assert(std::is_trivially_copyable<Tout>::value, "Out of core output requires trivially copyable records");
+    size_t chunk = chunk_size && chunk_size != CHUNK_AUTO ? chunk_size : DEFAULT_STREAM_CHUNK;
+
+    size_t inFlight = execEnv.workers_addrs.size() * PREASSIGNSIZE * chunk * (sizeof(Tin) + sizeof(Tout));
+    size_t available = execEnv.memoryBudget > inFlight ? execEnv.memoryBudget - inFlight : 0;
+    if (execEnv.isMaster && available < chunk * (sizeof(Tin) + sizeof(Tout)))
+        ff::error("Memory budget too small for the chunks in flight, using one chunk as input window and output buffer\n");
+
+    RecordSource<Tin> source{input.range, std::max(chunk, available / 2 / sizeof(Tin))};
+    RecordSink<Tout> sink{std::make_shared<typename RecordSink<Tout>::spill>()};
+    sink.state->range = output.range;
+    sink.state->bufferItems = std::max(chunk, available / 2 / sizeof(Tout));
+
+    if (execEnv.isMaster && output.create(input.items()) < 0)
+        return -1;
+
+    std::shared_ptr<bool> readFailed = source.failed;
+    int result = stream_map(execEnv, f, std::move(source), sink, chunk, env, wth);
+    if (execEnv.isMaster){
+        sink.state->flush(); // the last run
+        if (*readFailed || sink.state->failed)
+            return -1;
+    }
+    return result;
+}
 }
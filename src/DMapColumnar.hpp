@@ -0,0 +1,204 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+#include <cereal/cereal.hpp>
+
+#ifndef DMAPCOLUMNAR_H
+#define DMAPCOLUMNAR_H
+
+/*
+    Columnar wire encoding of the data of a Dtask, for trivially copyable element types. It is opt-in, by specializing DColumnar
+    after including DMap.hpp, before the first Dtask<T> is serialized (master and workers are the same program, so both ends agree):
+
+        struct Row { int32_t key; int32_t count; };
+        template<> struct DColumnar<Row> : DColumns<int32_t> {};
+
+    Every element is seen as sizeof(T)/sizeof(Word) integer words, and column c is word c of all the elements. Each column is
+    delta encoded (against the same word of the previous element), zig-zag mapped and stored either as varints or bit-packed with
+    the width of its largest value, whichever is smaller; a column that would grow is stored as is (little endian words).
+    Sorted, clustered or small valued fields shrink to a few bits per value.
+    The word should match the width of the fields (char for byte arrays), otherwise a field is split over several columns.
+*/
+template<typename T>
+struct DColumnar {
+    static constexpr bool enabled = false;
+};
+
+template<typename Word>
+struct DColumns {
+    static_assert(std::is_integral<Word>::value, "Columns are made of integer words");
+    static constexpr bool enabled = true;
+    using word = Word;
+};
+
+#define COLUMN_VARINT 0
+#define COLUMN_PACKED 1
+#define COLUMN_RAW    2
+
+namespace columnar {
+
+inline uint64_t zigzag(int64_t v){ return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63); }
+inline int64_t unzigzag(uint64_t v){ return (int64_t)(v >> 1) ^ -(int64_t)(v & 1); }
+
+/*
+    Append the column c (of columns) of the n elements at base, each word reinterpreted as Word
+*/
+template<typename Word>
+void encodeColumn(const char* base, size_t n, size_t columns, size_t c, std::vector<uint8_t>& out, std::vector<uint64_t>& values){
+    typedef typename std::make_unsigned<Word>::type U;
+    typedef typename std::make_signed<Word>::type S;
+
+    values.resize(n);
+    U prev = 0;
+    auto word = [&](size_t i){
+        U v;
+        std::memcpy(&v, base + (i * columns + c) * sizeof(Word), sizeof(Word));
+        return v;
+    };
+    uint64_t all = 0;
+    size_t varintBytes = 0;
+    for (size_t i = 0; i < n; i++){
+        U v = word(i);
+        values[i] = zigzag((S)(U)(v - prev));
+        prev = v;
+        all |= values[i];
+        for (uint64_t x = values[i]; ; x >>= 7){
+            varintBytes++;
+            if (x < 128) break;
+        }
+    }
+    size_t bits = 0;
+    while (bits < 64 && (all >> bits)) bits++;
+
+    size_t packedBytes = bits <= 56 ? (n * bits + 7) / 8 + 1 : SIZE_MAX;
+    if (std::min(packedBytes, varintBytes) >= n * sizeof(Word)){
+        out.push_back(COLUMN_RAW);
+        for (size_t i = 0; i < n; i++){
+            uint64_t v = word(i);
+            for (size_t b = 0; b < sizeof(Word); b++, v >>= 8)
+                out.push_back((uint8_t)v);
+        }
+    } else if (packedBytes < varintBytes){
+        out.push_back(COLUMN_PACKED);
+        out.push_back((uint8_t)bits);
+        uint64_t acc = 0;
+        size_t pending = 0;
+        for (size_t i = 0; i < n; i++){
+            acc |= values[i] << pending;
+            for (pending += bits; pending >= 8; pending -= 8, acc >>= 8)
+                out.push_back((uint8_t)acc);
+        }
+        if (pending) out.push_back((uint8_t)acc);
+    } else {
+        out.push_back(COLUMN_VARINT);
+        for (size_t i = 0; i < n; i++){
+            uint64_t x = values[i];
+            for (; x >= 128; x >>= 7)
+                out.push_back((uint8_t)(x | 128));
+            out.push_back((uint8_t)x);
+        }
+    }
+}
+
+/*
+    Decode the column c of n elements from in (advanced past it) directly into the elements at base. False on malformed input.
+*/
+template<typename Word>
+bool decodeColumn(const uint8_t*& in, const uint8_t* end, char* base, size_t n, size_t columns, size_t c){
+    typedef typename std::make_unsigned<Word>::type U;
+
+    if (in >= end) return false;
+    uint8_t mode = *in++;
+    U prev = 0;
+    auto store = [&](size_t i, uint64_t value){
+        prev = (U)(prev + (U)unzigzag(value));
+        std::memcpy(base + (i * columns + c) * sizeof(Word), &prev, sizeof(Word));
+    };
+
+    if (mode == COLUMN_PACKED){
+        if (in >= end) return false;
+        size_t bits = *in++;
+        if (bits > 56 || (size_t)(end - in) < (n * bits + 7) / 8) return false;
+        uint64_t acc = 0, mask = bits ? (~0ull >> (64 - bits)) : 0;
+        size_t available = 0;
+        for (size_t i = 0; i < n; i++){
+            while (available < bits){
+                acc |= (uint64_t)*in++ << available;
+                available += 8;
+            }
+            store(i, acc & mask);
+            acc = bits ? acc >> bits : acc;
+            available -= bits;
+        }
+        return true;
+    }
+    if (mode == COLUMN_RAW){
+        if ((size_t)(end - in) < n * sizeof(Word)) return false;
+        for (size_t i = 0; i < n; i++){
+            uint64_t v = 0;
+            for (size_t b = 0; b < sizeof(Word); b++)
+                v |= (uint64_t)*in++ << (8 * b);
+            U w = (U)v;
+            std::memcpy(base + (i * columns + c) * sizeof(Word), &w, sizeof(Word));
+        }
+        return true;
+    }
+    if (mode != COLUMN_VARINT) return false;
+
+    for (size_t i = 0; i < n; i++){
+        uint64_t x = 0;
+        for (size_t shift = 0; ; shift += 7){
+            if (in >= end || shift > 63) return false;
+            uint8_t b = *in++;
+            x |= (uint64_t)(b & 127) << shift;
+            if (b < 128) break;
+        }
+        store(i, x);
+    }
+    return true;
+}
+
+}
+
+/*
+    Cereal wrapper sending a vector of T in the columnar encoding of DColumnar<T>: <elements> <encoded bytes> <bytes>
+*/
+template<typename T, typename Alloc>
+struct DColumnarData {
+    typedef typename DColumnar<T>::word Word;
+    static_assert(std::is_trivially_copyable<T>::value, "The columnar encoding requires trivially copyable elements");
+    static_assert(sizeof(T) % sizeof(Word) == 0, "The element size must be a multiple of the column word");
+    static constexpr size_t columns = sizeof(T) / sizeof(Word);
+
+    std::vector<T, Alloc>& data;
+
+    template<class Archive>
+    void save(Archive& ar) const {
+        std::vector<uint8_t> bytes;
+        std::vector<uint64_t> values;
+        bytes.reserve(data.size() * sizeof(T) / 2);
+        for (size_t c = 0; c < columns; c++)
+            columnar::encodeColumn<Word>((const char*)data.data(), data.size(), columns, c, bytes, values);
+        ar((uint64_t)data.size(), (uint64_t)bytes.size());
+        ar(cereal::binary_data(bytes.data(), bytes.size()));
+    }
+
+    template<class Archive>
+    void load(Archive& ar){
+        uint64_t n, len;
+        ar(n, len);
+        std::vector<uint8_t> bytes(len);
+        ar(cereal::binary_data(bytes.data(), len));
+        data.resize(n);
+        const uint8_t* in = bytes.data();
+        for (size_t c = 0; c < columns; c++)
+            if (!columnar::decodeColumn<Word>(in, bytes.data() + len, (char*)data.data(), n, columns, c))
+                throw cereal::Exception("Malformed columnar data");
+    }
+};
+
+#endif
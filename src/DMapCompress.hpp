@@ -0,0 +1,166 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#ifndef DMAPCOMPRESS_H
+#define DMAPCOMPRESS_H
+
+#define COMPRESS_MIN_BYTES 4096 // smaller frames are never compressed
+#define COMPRESS_PROBE 32       // every COMPRESS_PROBE-th frame is compressed anyway, to keep the ratio estimate up to date
+#define COMPRESS_HASH_BITS 14
+
+/*
+    Byte oriented LZ77 codec (in the spirit of LZ4) for the payload of the frames. The output is a sequence of
+        <token> [literal length bytes] <literals> [<offset, 2 bytes LE> [match length bytes]]
+    where the token holds the literal length (high nibble) and the match length - 4 (low nibble); a nibble of 15 continues in the
+    following bytes, each adding up to 255. The last sequence has literals only. Matches are found through a hash table of 4 byte
+    sequences and reach back at most 64 KiB.
+
+    Compress n bytes of src into dst of capacity cap. Returns the compressed size, 0 if it does not fit (incompressible data).
+*/
+inline size_t DCompress(const char* src, size_t n, char* dst, size_t cap){
+    const unsigned char* in = (const unsigned char*)src;
+    unsigned char* out = (unsigned char*)dst;
+    unsigned char* outEnd = out + cap;
+    std::vector<uint32_t> table(1 << COMPRESS_HASH_BITS, 0);
+    size_t anchor = 0, i = 0;
+
+    auto length = [&](size_t len){
+        for (; len >= 255; len -= 255){
+            if (out >= outEnd) return false;
+            *out++ = 255;
+        }
+        if (out >= outEnd) return false;
+        *out++ = (unsigned char)len;
+        return true;
+    };
+    // the literals [anchor, anchor + literals) followed by a match of the given length (0 => last sequence)
+    auto sequence = [&](size_t literals, size_t match, size_t offset){
+        if (out >= outEnd) return false;
+        unsigned char* token = out++;
+        *token = (unsigned char)((literals >= 15 ? 15 : literals) << 4);
+        if (literals >= 15 && !length(literals - 15)) return false;
+        if ((size_t)(outEnd - out) < literals) return false;
+        if (literals) std::memcpy(out, in + anchor, literals);
+        out += literals;
+        if (!match) return true;
+
+        if (outEnd - out < 2) return false;
+        *out++ = offset & 255;
+        *out++ = offset >> 8;
+        match -= 4;
+        *token |= (unsigned char)(match >= 15 ? 15 : match);
+        return match < 15 || length(match - 15);
+    };
+
+    while (i + 4 <= n){
+        uint32_t seq, candSeq;
+        std::memcpy(&seq, in + i, 4);
+        uint32_t h = (seq * 2654435761u) >> (32 - COMPRESS_HASH_BITS);
+        size_t cand = table[h];
+        table[h] = (uint32_t)i;
+        std::memcpy(&candSeq, in + cand, 4);
+        if (cand < i && i - cand <= 65535 && candSeq == seq){
+            size_t len = 4;
+            while (i + len < n && in[cand + len] == in[i + len])
+                len++;
+            if (!sequence(i - anchor, len, i - cand)) return 0;
+            i += len;
+            anchor = i;
+        } else
+            i++;
+    }
+    if (!sequence(n - anchor, 0, 0)) return 0;
+    return out - (unsigned char*)dst;
+}
+
+/*
+    Decompress n bytes of src into exactly len bytes of dst. False if src is not a valid compressed payload of that size.
+*/
+inline bool DDecompress(const char* src, size_t n, char* dst, size_t len){
+    const unsigned char* in = (const unsigned char*)src;
+    const unsigned char* inEnd = in + n;
+    unsigned char* out = (unsigned char*)dst;
+    unsigned char* outEnd = out + len;
+
+    auto length = [&](size_t& l){
+        unsigned char b;
+        do {
+            if (in >= inEnd) return false;
+            l += (b = *in++);
+        } while (b == 255);
+        return true;
+    };
+
+    while (in < inEnd){
+        unsigned char token = *in++;
+        size_t literals = token >> 4;
+        if (literals == 15 && !length(literals)) return false;
+        if ((size_t)(inEnd - in) < literals || (size_t)(outEnd - out) < literals) return false;
+        if (literals) std::memcpy(out, in, literals);
+        in += literals;
+        out += literals;
+        if (in == inEnd) break; // the last sequence
+
+        if (inEnd - in < 2) return false;
+        size_t offset = in[0] | (in[1] << 8);
+        in += 2;
+        size_t match = token & 15;
+        if (match == 15 && !length(match)) return false;
+        match += 4;
+        if (!offset || offset > (size_t)(out - (unsigned char*)dst) || (size_t)(outEnd - out) < match) return false;
+        // the match may overlap the output being written: copy it in blocks of at most offset bytes, each one already written
+        const unsigned char* from = out - offset;
+        while (match){
+            size_t block = std::min(match, offset);
+            std::memcpy(out, from, block);
+            out += block;
+            from += block;
+            match -= block;
+        }
+    }
+    return out == outEnd;
+}
+
+/*
+    Per frame decision of a sender: compress when the transfer time saved on the link is larger than the time spent compressing
+    and decompressing (taken as twice the compression time). The ratio and the compression speed are averaged over the compressed
+    frames, the link throughput over the frames written (or fixed by the user).
+*/
+class DCompressionPolicy {
+public:
+    DCompressionPolicy(double _linkBytesPerSec = 0) : fixedLink(_linkBytesPerSec) {}
+
+    bool shouldCompress(size_t bytes){
+        if (bytes < COMPRESS_MIN_BYTES) return false;
+        if (++frames % COMPRESS_PROBE == 0 || ratio < 0) return true;
+        double link = fixedLink > 0 ? fixedLink : linkSpeed;
+        if (link <= 0 || speed <= 0) return true;
+        return bytes * (1 - ratio) / link > 2 * bytes / speed;
+    }
+
+    // a frame of in bytes was compressed to out bytes (0 => incompressible) in the given seconds
+    void compressed(size_t in, size_t out, double seconds){
+        double r = out ? (double)out / in : 1;
+        ratio = ratio < 0 ? r : 0.8 * ratio + 0.2 * r;
+        if (seconds > 0)
+            speed = speed > 0 ? 0.8 * speed + 0.2 * in / seconds : in / seconds;
+    }
+
+    // a frame of the given bytes was written in the given seconds
+    void written(size_t bytes, double seconds){
+        if (bytes < COMPRESS_MIN_BYTES || seconds <= 0) return;
+        linkSpeed = linkSpeed > 0 ? 0.8 * linkSpeed + 0.2 * bytes / seconds : bytes / seconds;
+    }
+
+    double compressionRatio() const { return ratio; }
+
+private:
+    double fixedLink = 0, linkSpeed = 0; // bytes/s
+    double ratio = -1, speed = 0;        // compressed / original, bytes/s
+    size_t frames = 0;
+};
+
+#endif
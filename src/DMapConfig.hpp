@@ -0,0 +1,100 @@
+#include <vector>
+#include <string>
+#include <sstream>
+#include <DMapPolicy.hpp>
+
+#ifndef DMAPCONFIG_H
+#define DMAPCONFIG_H
+
+/*
+    Runtime knobs of a DMap process. DMap::Exec extends this struct, so each field can be filled by the command line parser
+    or set directly by the user code before calling DMap::map.
+*/
+struct DMapConfig {
+
+    /*
+        Thread placement of a worker: <receiver cpu>,<sender cpu>,<compute cpu>,<compute cpu>,... (-1 => unpinned)
+    */
+    std::vector<int> cpuMap;
+
+    /*
+        Master threads writing results back into the output container (0 => the scheduler does it)
+    */
+    size_t writeBackThreads = 2;
+
+    /*
+        Bytes of data the master may hold in DMap::out_of_core_map
+    */
+    size_t memoryBudget = 256 << 20;
+
+    /*
+        Chunks (or partitions) each worker gets at startup with dynamic scheduling
+    */
+    size_t preassign = PREASSIGNSIZE;
+
+    /*
+        Maps with chunk size CHUNK_AUTO: share of the chunk time that may go in per message overhead
+    */
+    double autoChunkOverhead = 0.05;
+
+    /*
+        Resident partitions: a worker takes a partition of another worker only if it has more than this many waiting
+    */
+    size_t localityDelay = 2;
+
+    /*
+        Workers balance a map over a range by stealing from each other, the master only collects the results
+    */
+    bool workStealing = false;
+
+    /*
+        Admit the workers as they connect; the map starts once minWorkers joined
+    */
+    bool elastic = false;
+    size_t minWorkers = 1;
+
+    /*
+        Compute threads of a worker inside the master process (0 => the master only schedules)
+    */
+    size_t masterThreads = 0;
+
+    /*
+        (built with TRACE) Chrome trace event file written by the master at the end of each map (empty => none)
+    */
+    std::string traceFile;
+
+    /*
+        Prometheus text file rewritten by the master every metricsInterval milliseconds (empty => none)
+    */
+    std::string metricsFile;
+    size_t metricsInterval = 1000;
+
+    /*
+        Compress the frames sent by this process when it pays off; compressionLinkMBs > 0 fixes the link throughput (MB/s)
+    */
+    bool compression = false;
+    double compressionLinkMBs = 0;
+
+    int receiverCpu() const { return cpuMap.size() > 0 ? cpuMap[0] : -1; }
+    int senderCpu() const { return cpuMap.size() > 1 ? cpuMap[1] : -1; }
+
+    std::vector<int> computeCpus() const {
+        if (cpuMap.size() <= 2) return {};
+        return std::vector<int>(cpuMap.begin() + 2, cpuMap.end());
+    }
+
+    /*
+        Parse a comma separated list of cpu ids (e.g. "0,1,2,4,6")
+    */
+    static std::vector<int> parseCpuList(const std::string& s){
+        std::vector<int> result;
+        std::stringstream ss(s);
+        std::string item;
+        while (getline(ss, item, ','))
+            if (!item.empty())
+                result.push_back(std::stoi(item));
+        return result;
+    }
+};
+
+#endif
@@ -0,0 +1,68 @@
+#include <network.hpp>
+#include <DMapPolicy.hpp>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#ifndef DMAPDATASET_H
+#define DMAPDATASET_H
+
+/*
+    Split items in partitions: one contiguous block per worker if chunk_size is 0, chunks of chunk_size assigned round robin otherwise
+*/
+inline std::vector<DPartition> makePartitions(size_t items, size_t workers, size_t chunk_size){
+    std::vector<DPartition> partitions;
+    size_t chunk = chunk_size ? chunk_size : (items + workers - 1) / workers; // fast ceiling positive numbers
+    for (size_t start = 0, i = 0; start < items; start += chunk, i++)
+        partitions.push_back({start, std::min(start + chunk, items), i % workers});
+    return partitions;
+}
+
+/*
+    Identifier of a new dataset. Master and workers run the same sequence of DMap calls, so they agree on the ids without exchanging them.
+*/
+inline size_t newDatasetId(){
+    static size_t nextId = 0;
+    return nextId++;
+}
+
+/*
+    Worker side storage of resident partitions, alive across map calls. Partitions are found by dataset id and begin_i.
+*/
+class DResidentStore {
+public:
+    static DResidentStore& instance(){
+        static DResidentStore store;
+        return store;
+    }
+
+    template<typename T>
+    void put(size_t dataset, Dtask<T>* partition){
+        std::lock_guard<std::mutex> lock(mtx);
+        partitions[dataset][partition->begin_i] = std::shared_ptr<void>(partition, [](void* p){ delete (Dtask<T>*)p; });
+    }
+
+    /*
+        The partition starting at begin_i, nullptr if it is not resident here
+    */
+    template<typename T>
+    Dtask<T>* get(size_t dataset, size_t begin_i){
+        std::lock_guard<std::mutex> lock(mtx);
+        auto ds = partitions.find(dataset);
+        if (ds == partitions.end()) return nullptr;
+        auto p = ds->second.find(begin_i);
+        return p == ds->second.end() ? nullptr : (Dtask<T>*)p->second.get();
+    }
+
+    void release(size_t dataset){
+        std::lock_guard<std::mutex> lock(mtx);
+        partitions.erase(dataset);
+    }
+
+private:
+    std::mutex mtx;
+    std::map<size_t, std::map<size_t, std::shared_ptr<void>>> partitions;
+};
+
+#endif
@@ -1,14 +1,35 @@
 #include <ff/ff.hpp>
+#include <ff/parallel_for.hpp>
 #include <network.hpp>
+#include <DMapConfig.hpp>
+#include <DMapDataset.hpp>
+#include <DMapPolicy.hpp>
+#include <algorithm>
 #include <iterator>
 #include <vector>
+#include <deque>
+#include <set>
+#include <functional>
+#include <type_traits>
+
+#ifndef DMAPMASTER_H
+#define DMAPMASTER_H
 
 /*
-    this param means how many chunk at staurtup the scheduler send to each worker in case of dynamic scheduling
-    Its purpose is to minimize idle time of the workers, as shown in detail in the report.
+    Where the data of a map lives when it does not travel between master and workers
 */
-#define PREASSIGNSIZE 1 
+struct DPlacement {
+    const DFileRange* inputFile = nullptr;  // the workers read the input from this file
+    const DFileRange* outputFile = nullptr; // the workers write the output to this file
+    std::vector<DPartition>* partitions = nullptr; // fixed chunks, preferably sent to their owner (updated if a partition moves)
+    bool residentInput = false;  // the input partitions are resident in the workers
+    bool cachedInput = false;    // the master holds a copy of the resident input as well, so partitions can be moved to another worker
+    bool residentOutput = false; // the output partitions stay resident in the workers
+    size_t items = 0;            // input length, used when the master does not hold the input
 
+    bool remoteInput() const { return inputFile || residentInput; }
+    bool remoteOutput() const { return outputFile || residentOutput; }
+};
 
 
 template<typename InputIterator, typename OutputIterator, typename Env = void>
@@ -17,50 +38,307 @@ private:
     typedef typename std::iterator_traits<InputIterator>::value_type Tin;
     typedef typename  std::iterator_traits<OutputIterator>::value_type Tout;
 
+    // private class implementing the write back of a result into the output container. Several of them run concurrently, each one on a different (non overlapping) output range
+    struct writer : public ff_node_t<Dtask<Tout>> {
+        OutputIterator begin_out;
+        DCounter* written = nullptr; // results written back by this thread, if counted
+
+        writer(OutputIterator _begin_out) : begin_out(_begin_out) {}
+
+        Dtask<Tout>* svc(Dtask<Tout>* in){
+            std::move(in->data.begin(), in->data.end(), std::next(begin_out, in->begin_i));
+            delete in;
+            if (written) written->add(1);
+            return this->GO_ON;
+        }
+    };
+
+    // private class implementing the worker running inside the master process. Its results reach the scheduler through the receiver, as the remote ones
+    struct localWorker : public ff_node_t<Dtask<Tin>> {
+        std::function<Tout(Tin&, Env*)> transformer;
+        Env* env;
+        ff::ParallelFor pf;
+        int threads;
+        DLocalChannel<Tout>& results;
+
+        localWorker(std::function<Tout(Tin&, Env*)> _transformer, Env* _env, int _threads, DLocalChannel<Tout>& _results)
+            : transformer(_transformer), env(_env), pf(_threads), threads(_threads), results(_results) {}
+
+        Dtask<Tin>* svc(Dtask<Tin>* in){
+            Dtask<Tout>* out = new Dtask<Tout>(in->id_worker, in->begin_i, in->end_i);
+            out->data.resize(in->end_i - in->begin_i);
+            DTRACE(out->times = in->times; out->times.workerRecv = out->times.computeStart = traceNow();)
+            this->pf.parallel_for_static(0, out->data.size(), 1, 0,
+                       [&](const long i)  {
+                                out->data[i] = transformer(in->data[i], env);
+                        }, threads);
+            DTRACE(out->times.workerSend = out->times.computeEnd = traceNow();)
+            delete in;
+            results.push(out);
+            return this->GO_ON;
+        }
+    };
+
     // private class implementing the scheduler
     struct scheduler : public ff_node_t<Dtask<Tout>, Dtask<Tin>> {
         bool boot = true;
         InputIterator begin_in, end_in;    
         OutputIterator begin_out;
         std::map<int,int> pCount;
+        DSchedulePolicy policy;       // which worker gets which range
+        std::vector<size_t> inFlight; // per worker, chunks sent and not yet completed
+        DMembership* members = nullptr; // workers join as they connect (nullptr => they are all connected at startup)
+        std::vector<bool> ready;        // workers joined so far
+        size_t minWorkers = 1, joined = 0;
+        std::vector<size_t> unreachable; // joined workers the master could not connect to, they never compute
+        std::set<size_t> leaving; // workers that asked to leave, still computing some chunks
+        ff::ff_farm writers; // accelerator farm performing the write back, empty if the write back is done by the scheduler itself
+        ff::ff_farm local;   // accelerator farm running the local worker (worker localId), empty if the master does not compute
+        std::vector<writer*> writeBackNodes;
+        DMetrics* metrics = nullptr; // live counters, if enabled
+        DTRACE(DTraceRing trace;) // completed chunks (built with TRACE)
+        DTRACE(std::string traceFile;)
+        size_t localId = SIZE_MAX;
+        bool stealing = false; // the workers balance the load by themselves, their blocks come back in many results
 
 
         scheduler(InputIterator  _begin_in, 
                   InputIterator _end_in, 
                   OutputIterator _begin_out, 
                   size_t _workers,
-                  size_t _chunk_size //chunk_size > 0 => dynamic scheduling 
-                  ) : begin_in(_begin_in), end_in(_end_in), begin_out(_begin_out), processedItems(0), workers(_workers), chunk_size(_chunk_size), nextItemToSend(0) { 
-                      this->total_distance = std::distance(_begin_in, _end_in);
+                  size_t _chunk_size, //chunk_size > 0 => dynamic scheduling, CHUNK_AUTO => chosen at run time
+                  size_t _writers,
+                  const DPlacement& _placement = DPlacement(), // data that the workers read/write by themselves (results are then just acknowledgements)
+                  size_t _localityDelay = 0,
+                  size_t _preassign = PREASSIGNSIZE,
+                  double _overheadTarget = 0.05
+                  ) : begin_in(_begin_in), end_in(_end_in), begin_out(_begin_out), writers(true), local(true), processedItems(0),
+                      partitions(_placement.partitions), remoteInput(_placement.remoteInput()), remoteOutput(_placement.remoteOutput()) { 
+                      this->total_distance = (remoteInput && !_placement.cachedInput) ? _placement.items : std::distance(_begin_in, _end_in);
+                      policy = DSchedulePolicy(total_distance, _workers, _chunk_size, _preassign, partitions,
+                                               !_placement.residentInput || _placement.cachedInput, _localityDelay, _overheadTarget);
 
-                        for(size_t i = 0; i < workers; i++)
+                        for(size_t i = 0; i < _workers; i++)
                             pCount[i] = 0;
+
+                        if (_writers > 0 && !remoteOutput){
+                            std::vector<ff_node*> w;
+                            for(size_t i = 0; i < _writers; i++){
+                                writeBackNodes.push_back(new writer(_begin_out));
+                                w.push_back(writeBackNodes.back());
+                            }
+                            writers.add_workers(w);
+                            writers.remove_collector();
+                            writers.cleanup_workers();
+                        }
                   }
 
+        /*
+            Workers are admitted as they join, the map starts as soon as minWorkers joined
+        */
+        void setMembership(DMembership* m, size_t _minWorkers){
+            members = m;
+            minWorkers = std::max<size_t>(_minWorkers, 1);
+        }
+
+        /*
+            Work stealing: a block comes back in many results, possibly from other workers, so it stays in flight until the map is over
+        */
+        void setStealing(){ stealing = true; }
+
+        /*
+            Keep the live counters of the scheduler and of the write back threads in m
+        */
+        void setMetrics(DMetrics* m){
+            metrics = m;
+            metrics->itemsTotal = total_distance;
+            for (size_t i = 0; i < writeBackNodes.size(); i++)
+                writeBackNodes[i]->written = &m->writtenBy(i);
+        }
+
+        /*
+            The master computes as well: w is one more worker, always ready, whose tasks are offloaded instead of being sent
+        */
+        void setLocalWorker(ff_node* w){
+            localId = policy.workers();
+            policy.addWorker(localId);
+            pCount[localId] = 0;
+            ready.resize(policy.workers(), false);
+            ready[localId] = true;
+            std::vector<ff_node*> workerNodes = {w};
+            local.add_workers(workerNodes);
+            local.remove_collector();
+            local.cleanup_workers();
+        }
+
+        int svc_init(){
+            // start the write back farm, it stays frozen-ready waiting for offloaded results
+            if (writers.getNWorkers() > 0 && writers.run_then_freeze() < 0){
+                error("Error starting the write back farm");
+                return -1;
+            }
+            if (local.getNWorkers() > 0 && local.run_then_freeze() < 0){
+                error("Error starting the local worker");
+                return -1;
+            }
+            return 0;
+        }
+
+        /*
+            Create the task of the range [start, end). The data is attached only if the workers cannot read it by themselves.
+        */
+        Dtask<Tin>* makeTask(size_t worker, size_t start, size_t end, bool moved = false){
+            if (remoteInput && !moved)
+                return new Dtask<Tin>(worker, start, end);
+            return new Dtask<Tin>(worker, start, end, std::next(begin_in, start), std::next(begin_in, end));
+        }
+
+        void sendTask(Dtask<Tin>* task){
+            if (task->id_worker >= inFlight.size())
+                inFlight.resize(task->id_worker + 1, 0);
+            inFlight[task->id_worker]++;
+            if (metrics) metrics->setInFlight(task->id_worker, inFlight[task->id_worker]);
+            DTRACE(task->times.dispatch = traceNow();)
+            if (task->id_worker == localId)
+                local.offload(task);
+            else {
+                if (metrics) metrics->tasksToSender.add(1);
+                this->ff_send_out(task);
+            }
+        }
+
+        void sendAssignment(const DSchedulePolicy::assignment& a){
+            sendTask(makeTask(a.worker, a.begin_i, a.end_i, a.moved));
+        }
+
+        /*
+            A joined worker is connected by the receiver and then gets its chunks (all the joined workers get them at start if it is the one
+            completing minWorkers). A leaving worker (elastic map) gets no other chunk and is released once the chunks it holds are done.
+            The ranges of a worker that could not be reached go to the others.
+        */
+        Dtask<Tin>* membership(Dtask<Tout>* in){
+            size_t id = in->id_worker;
+            size_t mark = in->begin_i;
+            delete in;
+
+            if (mark == MARK_LEAVE){
+                leaving.insert(id);
+                release(id);
+                return this->GO_ON;
+            }
+
+            if (mark == MARK_DROP){
+                unreachable.push_back(id);
+                if (!boot){
+                    drop(id);
+                    return this->GO_ON;
+                }
+                // every listed worker either joined or failed: start with the ones there are
+                if (!settled() || joined >= minWorkers)
+                    return this->GO_ON;
+                if (joined > 0 || localId != SIZE_MAX)
+                    return start();
+                error("No worker could be reached\n");
+                members->finish();
+                return this->EOS;
+            }
+
+            joined++;
+            policy.addWorker(id);
+            if (ready.size() < policy.workers()) ready.resize(policy.workers(), false);
+            ready[id] = true;
+            if (!pCount.count(id)) pCount[id] = 0;
+            this->ff_send_out(new Dtask<Tin>(id, MARK_JOIN, MARK_JOIN));
+
+            if (boot)
+                return (joined >= minWorkers || settled()) ? start() : this->GO_ON;
+
+            fill(id);
+            return this->GO_ON;
+        }
+
+        // every listed worker either joined or could not be reached (never the case of an elastic map)
+        bool settled(){
+            return !members->isOpen() && joined + unreachable.size() >= members->listed();
+        }
+
+        /*
+            Worker id will never compute: what the policy had set aside for it goes to the workers with room for more
+        */
+        void drop(size_t id){
+            DSchedulePolicy::assignment next;
+            policy.drop(id);
+            for (size_t w = 0; w < ready.size(); w++)
+                if (ready[w] && !leaving.count(w))
+                    while (policy.next(w, next, getusec()))
+                        sendAssignment(next);
+        }
+
+        /*
+            Send the EOS to a leaving worker if none of its chunks is still running
+        */
+        void release(size_t id){
+            if (leaving.count(id) && (id >= inFlight.size() || inFlight[id] == 0)){
+                leaving.erase(id);
+                this->ff_send_out(new Dtask<Tin>(id, MARK_LEAVE, MARK_LEAVE));
+            }
+        }
+
+        void writeBack(Dtask<Tout>* in){
+            if (remoteOutput){ // already written by the worker
+                delete in;
+                return;
+            }
+            if (writers.getNWorkers() > 0){
+                if (metrics) metrics->writeBacksOffloaded.add(1);
+                writers.offload(in);
+                return;
+            }
+            std::move(in->data.begin(), in->data.end(), std::next(begin_out, in->begin_i));
+            delete in;
+        }
+
+        /*
+            First tasks of a worker (see DSchedulePolicy::fill)
+        */
+        void fill(size_t w){
+            for (const auto& a : policy.fill(w, getusec()))
+                sendAssignment(a);
+        }
+
+        /*
+            Startup: fill the workers with tasks, or just the ones already joined if workers join as they connect
+        */
+        Dtask<Tin>* start(){
+            this->Tstart = getusec(); // start taking time
+            boot = false;
+
+            // resident partitions: every worker is preferably filled with the partitions it holds
+            if (partitions && policy.empty())
+                return this->EOS;
+
+            // if static scheduling were selected, the chunk size is computed based on the number of workers
+            policy.start();
+
+            // Fill up all the workers, sent multiple chunk at sturtup if the preassign depth is greater than 1 and we are using dynamic policy
+            for (size_t w = 0; w < policy.workers(); w++)
+                if (!members || (w < ready.size() && ready[w]))
+                    fill(w);
+            for (size_t id : unreachable)
+                drop(id);
+            
+            return this->GO_ON;
+        }
+
         Dtask<Tin>* svc(Dtask<Tout>* in){
+            // a worker joined, could not be reached or asked to leave (elastic map)
+            if (members && (in->begin_i == MARK_JOIN || in->begin_i == MARK_LEAVE || in->begin_i == MARK_DROP))
+                return membership(in);
+
             // this if branch is executed just once, in particular during startup to fill workers with tasks
             if (boot){
-                this->Tstart = getusec(); // start taking time
-                boot = false; delete in; 
-                bool isStaticScheduling = (chunk_size == 0);
-
-                // if static scheduling were selected, compute the chunk size based on the number of workers
-                size_t chunk = isStaticScheduling ? ((total_distance + workers - 1) / workers) : chunk_size; // fast ceiling positive numbers
-
-                // Fill up all the workers, sent multiple chunk at sturtup if PREASSIGNSIZE is greater than 1 and we are using dynamic policy
-                for (int i = 0 ; i < (isStaticScheduling ? 1 : PREASSIGNSIZE); i++){
-                    for (size_t w = 0; w < workers; w++){
-                        size_t start = i*chunk*workers + w*chunk; 
-                        if (start > total_distance)
-                            break;
-                        size_t end = (start+chunk > total_distance) ? total_distance : start+chunk;
-                        this->ff_send_out(new Dtask<Tin>(w, start, end, std::next(begin_in, start), std::next(begin_in, end)));
-                    }
-                    // takes note to the next item that need to be sent - Usefull only for dynamic scheduling
-                    nextItemToSend = (i+1)*workers*chunk >= total_distance ? total_distance : (i+1)*workers*chunk;
-                }
-                
-                return this->GO_ON;
+                delete in;
+                return start();
             }
             
             #ifdef VERBOSE
@@ -70,32 +348,62 @@ private:
             // count a new task completed for the specific worker, debug purposes only
             pCount[in->id_worker]++;
 
-            // write back the results
-            auto outIterator = std::next(begin_out, in->begin_i);
-            for(auto obj : in->data)
-                *outIterator++ = obj;
-            
             // update the number of already processed elements
             processedItems += (in->end_i - in->begin_i);
-
-            if (chunk_size && (nextItemToSend < total_distance)){ // there is more to process (i.e dynamic scheduling)
-                size_t end = nextItemToSend+chunk_size > total_distance ? total_distance : nextItemToSend+chunk_size;
-                // send the new task to the same worker from which i received the result
-                this->ff_send_out(new Dtask<Tin>(in->id_worker, nextItemToSend, end, std::next(begin_in, nextItemToSend), std::next(begin_in, end)));
-                nextItemToSend = end;
+            DTRACE(trace.push({in->id_worker, in->begin_i, in->end_i, in->times});)
+            if (!stealing && in->id_worker < inFlight.size() && inFlight[in->id_worker])
+                inFlight[in->id_worker]--;
+            if (metrics){
+                metrics->resultsHandled.add(1);
+                metrics->itemsProcessed.set(processedItems);
+                if (!stealing) metrics->setInFlight(in->id_worker, inFlight[in->id_worker]);
             }
 
-            delete in;
+            // dispatch first, so that the worker does not wait for the write back of its previous result
+            // (the new task goes to the same worker from which i received the result, unless it is leaving)
+            DSchedulePolicy::assignment next;
+            policy.completed(in->id_worker, in->begin_i, in->end_i, getusec());
+            if (leaving.count(in->id_worker))
+                release(in->id_worker);
+            else while (policy.next(in->id_worker, next, getusec()))
+                sendAssignment(next);
+
+            // write back the results (concurrently with the next results if the write back farm is enabled)
+            writeBack(in);
             
             // if i'm received the lest result 
             if (processedItems == total_distance){
+                // wait for the pending write backs before declaring the map completed
+                if (writers.getNWorkers() > 0){
+                    writers.offload(this->EOS);
+                    writers.wait();
+                }
+                if (local.getNWorkers() > 0){
+                    local.offload(this->EOS);
+                    local.wait();
+                }
+
                 std::cout << "Elapsed time: " << (getusec()-(this->Tstart))/1000 << " ms" << std::endl;
 
                 // print the number of tasks received each worker - Debug purposes only - Can be wrappein in a #ifdef VERBOSE #endif
                 for (auto [worker, partitions] : pCount)
                     std::cout << "Worker #" << worker << " received " << partitions << "partitions" << std::endl;
 
-                // the computation is over, send the End of stream to all the workers
+                if (partitions)
+                    std::cout << "Local assignments: " << policy.localAssignments << " - Remote assignments: " << policy.remoteAssignments << std::endl;
+                if (policy.isAuto())
+                    std::cout << "Auto chunk size: " << policy.chunkSize() << " items, " << policy.inFlightWindow() << " chunks in flight per worker ("
+                              << policy.retunes << " re-tunes)" << std::endl;
+
+                DTRACE(
+                    std::cout.flush();
+                    trace.report(getusec() - this->Tstart);
+                    if (!traceFile.empty() && trace.dump(traceFile) < 0)
+                        error("Error writing the trace file %s\n", traceFile.c_str());
+                )
+
+                // the computation is over, send the End of stream to all the workers (no other worker can join)
+                if (members) members->finish();
                 return this->EOS;   
             }
 
@@ -104,16 +412,104 @@ private:
 
         private:
             size_t processedItems;
-            size_t workers, chunk_size, nextItemToSend;
             size_t total_distance;
             size_t Tstart;      
+            std::vector<DPartition>* partitions;
+            bool remoteInput, remoteOutput;
     };
 
 public:
-    DMapMaster(std::string master_addr, std::vector<std::string> worker_addresses, InputIterator begin_in, InputIterator end_in, OutputIterator begin_out, Env* e = nullptr, size_t chunk_size = 0 ) {
+    DMapMaster(std::string master_addr, std::vector<std::string> worker_addresses, InputIterator begin_in, InputIterator end_in, OutputIterator begin_out, Env* e = nullptr, size_t chunk_size = 0, const DMapConfig& cfg = DMapConfig())
+        : DMapMaster(master_addr, worker_addresses, begin_in, end_in, begin_out, DPlacement(), e, chunk_size, cfg) {}
+
+    /*
+        Part of the data is not moved by the master (see DPlacement): the master sends only the ranges of such input and, for such output,
+        receives just acknowledgements. The iterators of the data not held by the master are not used.
+    */
+    DMapMaster(std::string master_addr, std::vector<std::string> worker_addresses, InputIterator begin_in, InputIterator end_in, OutputIterator begin_out, const DPlacement& placement, Env* e = nullptr, size_t chunk_size = 0, const DMapConfig& cfg = DMapConfig())
+        : members(isElastic(cfg, placement) ? std::vector<std::string>() : worker_addresses, isElastic(cfg, placement)), env(e), metrics(cfg.writeBackThreads) {
+        // with work stealing the master just sends one block per worker (static scheduling), the workers balance the load among themselves
+        bool elastic = isElastic(cfg, placement);
+        bool stealing = cfg.workStealing && !placement.partitions && !elastic;
+
+        // the workers of the built-in launcher are reachable by the master only (their addresses are its socketpairs)
+        if (stealing && std::any_of(worker_addresses.begin(), worker_addresses.end(), isPreconnected)){
+            error("Work stealing is not supported with the built-in launcher, the map is scheduled by the master\n");
+            stealing = false;
+        }
+
         // create the stages for the Master pipeline
-        this->add_stage(new receiver<Tout>(master_addr, worker_addresses.size(), true), true);
-        this->add_stage(new scheduler(begin_in, end_in, begin_out, worker_addresses.size(), chunk_size), true);
-        this->add_stage(new sender<Tin, Env>(0, worker_addresses, e), true);
+        r = new receiver<Tout>(master_addr, worker_addresses.size(), true);
+        sc = new scheduler(begin_in, end_in, begin_out, elastic ? 0 : worker_addresses.size(), stealing ? 0 : chunk_size, cfg.writeBackThreads, placement, cfg.localityDelay, cfg.preassign, cfg.autoChunkOverhead);
+        sender<Tin, Env>* s = new sender<Tin, Env>(0, worker_addresses, e);
+        if (placement.inputFile) s->setInputFile(*placement.inputFile);
+        if (placement.outputFile) s->setOutputFile(*placement.outputFile);
+        if (stealing){
+            sc->setStealing();
+            s->setPeers(chunk_size && chunk_size != CHUNK_AUTO ? chunk_size : DEFAULT_STEAL_CHUNK);
+        }
+        if (cfg.compression) s->setCompression(cfg.compressionLinkMBs);
+        DTRACE(sc->traceFile = cfg.traceFile;)
+
+        // live counters, written to the metrics file until the map is over (this object is destroyed)
+        if (!cfg.metricsFile.empty()){
+            r->setMetrics(&metrics);
+            sc->setMetrics(&metrics);
+            s->setMetrics(&metrics);
+            metrics.start(cfg.metricsFile, cfg.metricsInterval);
+        }
+
+        // the scheduler starts as soon as minWorkers introduced themselves (in an elastic map any worker can, the command line list is not used)
+        r->setMembership(&members);
+        sc->setMembership(&members, cfg.minWorkers);
+        s->setMembership(&members);
+
+        this->add_stage(r, true);
+        this->add_stage(sc, true);
+        this->add_stage(s, true);
+
+        // the master computes only plain maps: its worker has no file nor resident dataset, and it is not a peer of the others
+        localAllowed = !elastic && !stealing && !placement.remoteInput() && !placement.remoteOutput();
+    }
+
+    /*
+        Let the master compute chunks as well, with a worker of the given compute threads running in this process (see DMapConfig::masterThreads).
+        Ignored if the map does not allow it.
+    */
+    template<typename Function>
+    void setLocalWorker(Function f, int threads){
+        if (!localAllowed || threads <= 0)
+            return;
+
+        std::function<Tout(Tin&, Env*)> transformer;
+        if constexpr (std::is_invocable<Function, Tin&, Env*>::value)
+            transformer = [f](Tin& in, Env* e) -> Tout { return f(in, e); };
+        else
+            transformer = [f](Tin& in, Env*) -> Tout { return f(in); };
+
+        r->setLocalChannel(&localResults);
+        sc->setLocalWorker(new localWorker(transformer, env, threads, localResults));
+    }
+
+    /*
+        Static scheduling on estimated costs (see DSchedulePolicy::setWeights)
+    */
+    void setCosts(std::vector<double> prefix){
+        sc->policy.setWeights(std::move(prefix));
+    }
+
+private:
+    static bool isElastic(const DMapConfig& cfg, const DPlacement& placement){
+        return cfg.elastic && !placement.partitions;
     }
-};
\ No newline at end of file
+
+    DMembership members;
+    Env* env;
+    receiver<Tout>* r;
+    scheduler* sc;
+    DLocalChannel<Tout> localResults;
+    bool localAllowed = false;
+    DMetrics metrics;
+};
+
+#endif
@@ -0,0 +1,135 @@
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef DMAPMETRICS_H
+#define DMAPMETRICS_H
+
+/*
+    Counter written by a single thread and read by any: the update is a relaxed load and store, with no lock nor read-modify-write.
+    A counter with several writers uses addShared instead.
+*/
+struct DCounter {
+    std::atomic<uint64_t> value{0};
+
+    void add(uint64_t n){ value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+    void addShared(uint64_t n){ value.fetch_add(n, std::memory_order_relaxed); }
+    void set(uint64_t n){ value.store(n, std::memory_order_relaxed); }
+    uint64_t get() const { return value.load(std::memory_order_relaxed); }
+};
+
+/*
+    Live counters of a map on the master (see DMapConfig::metricsFile). Each counter has one writer, noted below; the reporter thread
+    reads them all and periodically rewrites the metrics file in the Prometheus text format. The depth of the queue between two stages
+    is what the first one pushed minus what the second one popped.
+*/
+class DMetrics {
+public:
+    DCounter bytesReceived, resultsReceived; // receiver
+    DCounter bytesSent, tasksSent;           // sender
+    DCounter retries;                        // sender and the connector threads of the receiver (addShared)
+    DCounter itemsProcessed, resultsHandled, tasksToSender, writeBacksOffloaded; // scheduler
+    size_t itemsTotal = 0;
+
+    DMetrics(size_t writeBackThreads = 0) : written(writeBackThreads) {}
+
+    ~DMetrics(){ stop(); }
+
+    // (writer thread i of the write back farm) results written back
+    DCounter& writtenBy(size_t i){ return written[i]; }
+
+    /*
+        (scheduler) Chunks in flight of a worker. A slot is added under the lock the first time a worker shows up, afterwards the update is lock free
+    */
+    void setInFlight(size_t worker, uint64_t n){
+        if (worker >= slots){
+            std::lock_guard<std::mutex> lock(mtx);
+            while (inFlight.size() <= worker)
+                inFlight.emplace_back();
+            slots = inFlight.size();
+        }
+        inFlight[worker].set(n);
+    }
+
+    /*
+        Rewrite path every interval milliseconds, and once more when stopped
+    */
+    void start(const std::string& _path, size_t interval){
+        path = _path;
+        reporter = std::thread([this, interval]{
+            std::unique_lock<std::mutex> lock(stopMtx);
+            while (!stopped){
+                stopCv.wait_for(lock, std::chrono::milliseconds(interval), [this]{ return stopped; });
+                write();
+            }
+        });
+    }
+
+    void stop(){
+        if (!reporter.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lock(stopMtx);
+            stopped = true;
+        }
+        stopCv.notify_one();
+        reporter.join();
+    }
+
+private:
+    /*
+        Write the snapshot to a temporary file renamed over path, so readers never see a partial file
+    */
+    void write(){
+        std::string tmp = path + ".tmp";
+        FILE* f = std::fopen(tmp.c_str(), "w");
+        if (!f) return;
+
+        auto metric = [f](const char* name, const char* type, const char* help, uint64_t value){
+            std::fprintf(f, "# HELP %s %s\n# TYPE %s %s\n%s %llu\n", name, help, name, type, name, (unsigned long long)value);
+        };
+        metric("dmap_items_processed_total", "counter", "Items whose results reached the master", itemsProcessed.get());
+        metric("dmap_items", "gauge", "Items of the map", itemsTotal);
+        metric("dmap_bytes_sent_total", "counter", "Bytes of the frames sent to the workers", bytesSent.get());
+        metric("dmap_bytes_received_total", "counter", "Bytes of the frames received from the workers", bytesReceived.get());
+        metric("dmap_connect_retries_total", "counter", "Failed connection attempts to the workers", retries.get());
+
+        std::fprintf(f, "# HELP dmap_chunks_in_flight Chunks sent to a worker and not completed yet\n# TYPE dmap_chunks_in_flight gauge\n");
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            for (size_t w = 0; w < inFlight.size(); w++)
+                std::fprintf(f, "dmap_chunks_in_flight{worker=\"%zu\"} %llu\n", w, (unsigned long long)inFlight[w].get());
+        }
+
+        uint64_t writtenBack = 0;
+        for (const DCounter& c : written)
+            writtenBack += c.get();
+        auto depth = [](uint64_t pushed, uint64_t popped){ return (unsigned long long)(pushed > popped ? pushed - popped : 0); };
+        std::fprintf(f, "# HELP dmap_queue_depth Items waiting between two stages of the master\n# TYPE dmap_queue_depth gauge\n");
+        std::fprintf(f, "dmap_queue_depth{stage=\"receiver_scheduler\"} %llu\n", depth(resultsReceived.get(), resultsHandled.get()));
+        std::fprintf(f, "dmap_queue_depth{stage=\"scheduler_sender\"} %llu\n", depth(tasksToSender.get(), tasksSent.get()));
+        std::fprintf(f, "dmap_queue_depth{stage=\"write_back\"} %llu\n", depth(writeBacksOffloaded.get(), writtenBack));
+
+        if (std::fclose(f) == 0)
+            std::rename(tmp.c_str(), path.c_str());
+    }
+
+    std::vector<DCounter> written;
+    std::mutex mtx; // protects the growth of inFlight
+    std::deque<DCounter> inFlight;
+    size_t slots = 0; // slots of inFlight, read by the scheduler only
+
+    std::string path;
+    std::thread reporter;
+    std::mutex stopMtx;
+    std::condition_variable stopCv;
+    bool stopped = false;
+};
+
+#endif
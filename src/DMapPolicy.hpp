@@ -0,0 +1,344 @@
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <deque>
+#include <map>
+#include <vector>
+
+#ifndef DMAPPOLICY_H
+#define DMAPPOLICY_H
+
+/*
+    this param means how many chunk at staurtup the scheduler send to each worker in case of dynamic scheduling
+    Its purpose is to minimize idle time of the workers, as shown in detail in the report.
+    It is the default of DMapConfig::preassign.
+*/
+#define PREASSIGNSIZE 1
+
+/*
+    Chunk size of DMap::map picking the chunk size by itself (see DSchedulePolicy)
+*/
+#define CHUNK_AUTO ((size_t)-1)
+
+// probe chunks per worker in auto mode, of PROBE_FIRST items then 4 times larger each
+#define PROBES 4
+#define PROBE_FIRST 16
+
+/*
+    A partition of a resident dataset: the items [begin_i, end_i) live in the memory of the worker owner
+*/
+struct DPartition {
+    size_t begin_i, end_i;
+    size_t owner;
+};
+
+/*
+    Scheduling policy of the master: which worker computes which range, and when. It does no communication, so the same code is
+    driven by the scheduler of DMapMaster and by the offline simulator (tests/simulator.cpp).
+
+    - static scheduling (chunk 0): one contiguous block per worker, sized on the workers known at start. Given the prefix sum of the
+      estimated item costs (see setWeights), the blocks have the same estimated work instead of the same number of items
+    - dynamic scheduling: preassign chunks in flight per worker, a new chunk for every result
+    - resident partitions: every worker computes the partitions it holds, then it may take one from the longest backlog (see next)
+    - auto chunk size (CHUNK_AUTO): every worker first computes PROBES chunks of increasing size, one at a time. Fitting their round trip
+      times as overhead + items * cost per item gives the smallest chunk whose overhead is below the target share, and the chunks
+      in flight needed to hide the overhead. The cost per item is then followed on the interval between the results of each worker:
+      when it drifts by more than a half, the chunk size is chosen again.
+
+    The caller reports every result with completed(), then asks next() until it returns false; the times are in microseconds, on any clock.
+*/
+class DSchedulePolicy {
+public:
+    struct assignment {
+        size_t worker, begin_i, end_i;
+        bool moved; // a partition computed by a worker not holding it, its data has to travel
+    };
+
+    size_t localAssignments = 0, remoteAssignments = 0;
+    size_t retunes = 0; // auto chunk size: choices after the first one
+
+    DSchedulePolicy() = default;
+
+    DSchedulePolicy(size_t _items, size_t _workers, size_t _chunk, size_t _preassign = PREASSIGNSIZE, std::vector<DPartition>* _partitions = nullptr,
+                    bool _movable = true, size_t _localityDelay = 0, double _overheadTarget = 0.05)
+        : totalItems(_items), nWorkers(_workers), chunk(_chunk), preassign(std::max<size_t>(_preassign, 1)), partitions(_partitions), movable(_movable),
+          localityDelay(_localityDelay), autoChunk(_chunk == CHUNK_AUTO && !_partitions), overheadTarget(_overheadTarget) {
+        window = preassign;
+        if (autoChunk){
+            chunk = 0; // chosen after the probes
+            window = 1;
+        }
+        inFlight.resize(nWorkers, 0);
+        if (partitions){
+            backlog.resize(nWorkers);
+            for (size_t p = 0; p < partitions->size(); p++){
+                if (backlog.size() <= (*partitions)[p].owner) backlog.resize((*partitions)[p].owner + 1);
+                backlog[(*partitions)[p].owner].push_back(p);
+            }
+        }
+    }
+
+    size_t items() const { return totalItems; }
+    size_t workers() const { return nWorkers; }
+    bool isAuto() const { return autoChunk; }
+    size_t chunkSize() const { return chunk; }
+    size_t inFlightWindow() const { return window; }
+
+    // nothing to compute at all (a dataset with no partitions)
+    bool empty() const { return partitions ? partitions->empty() : totalItems == 0; }
+
+    /*
+        Worker id can get ranges from now on
+    */
+    void addWorker(size_t id){
+        nWorkers = std::max(nWorkers, id + 1);
+        if (partitions && backlog.size() < nWorkers) backlog.resize(nWorkers);
+        if (inFlight.size() < nWorkers) inFlight.resize(nWorkers, 0);
+    }
+
+    /*
+        Static scheduling on estimated costs: prefix[i] is the cost of the items before i, so prefix has items + 1 entries
+    */
+    void setWeights(std::vector<double> prefix){
+        if (prefix.size() == totalItems + 1)
+            weights = std::move(prefix);
+    }
+
+    /*
+        The map starts: with static scheduling the input is split among the workers known now
+    */
+    void start(){
+        staticChunk = nWorkers ? (totalItems + nWorkers - 1) / nWorkers : totalItems; // fast ceiling positive numbers
+        if (weights.empty() || !nWorkers) return;
+        if (!(weights.back() > 0)){ // no cost estimate at all: equal blocks
+            weights.clear();
+            return;
+        }
+        // every item costs at least a small share of the average, so that runs of zero cost items are still spread
+        double epsilon = weights.back() / totalItems * 1e-3;
+        for (size_t i = 1; i <= totalItems; i++)
+            weights[i] += epsilon * i;
+
+        // worker w gets the items whose cost prefix falls in [w, w+1) * total / nWorkers
+        bounds.assign(nWorkers + 1, totalItems);
+        bounds[0] = 0;
+        for (size_t w = 1; w < nWorkers; w++){
+            double target = weights.back() * w / nWorkers;
+            bounds[w] = std::max(bounds[w - 1], (size_t)(std::lower_bound(weights.begin(), weights.end(), target) - weights.begin()));
+        }
+    }
+
+    /*
+        First ranges of worker w: a window of chunks (or partitions) with dynamic scheduling, its block with static scheduling
+    */
+    std::vector<assignment> fill(size_t w, double now = 0){
+        std::vector<assignment> result;
+        assignment a;
+        if (partitions || chunk || autoChunk){
+            while (next(w, a, now))
+                result.push_back(a);
+            return result;
+        }
+
+        if (w >= inFlight.size()) addWorker(w);
+        if (!bounds.empty()){
+            if (w + 1 < bounds.size() && bounds[w] < bounds[w + 1])
+                result.push_back({w, bounds[w], bounds[w + 1], false});
+        } else {
+            size_t start = w*staticChunk;
+            if (start < totalItems)
+                result.push_back({w, start, std::min(start + staticChunk, totalItems), false});
+        }
+        inFlight[w] += result.size();
+        return result;
+    }
+
+    /*
+        Worker w will never compute (it could not be reached), to be called after start: its static block goes to the next worker
+        asking for more, its partitions to the workers running out of their own (if the input can be moved)
+    */
+    void drop(size_t w){
+        if (w >= inFlight.size()) addWorker(w);
+        if (dropped.size() < nWorkers) dropped.resize(nWorkers, false);
+        dropped[w] = true;
+        if (!partitions && !chunk && !autoChunk)
+            for (assignment a : fill(w))
+                orphans.push_back(a);
+    }
+
+    /*
+        Next range of worker w, if it has less than the window in flight. False if the worker has nothing more to get now.
+    */
+    bool next(size_t w, assignment& a, double now = 0){
+        if (w >= inFlight.size()) addWorker(w);
+        if (inFlight[w] >= window)
+            return false;
+        if (!orphans.empty()){
+            a = orphans.front();
+            a.worker = w;
+            orphans.pop_front();
+        } else if (!(partitions ? nextPartition(w, a) : nextChunk(w, a)))
+            return false;
+        inFlight[w]++;
+        if (autoChunk) sentAt[a.begin_i] = now;
+        return true;
+    }
+
+    /*
+        The result of [begin_i, end_i) computed by worker w came back at time now
+    */
+    void completed(size_t w, size_t begin_i, size_t end_i, double now = 0){
+        if (w >= inFlight.size()) addWorker(w);
+        if (inFlight[w]) inFlight[w]--;
+        if (!autoChunk) return;
+
+        auto sent = sentAt.find(begin_i);
+        if (sent == sentAt.end()) return;
+        double rtt = now - sent->second;
+        sentAt.erase(sent);
+        size_t n = end_i - begin_i;
+        if (!n) return;
+
+        workerState& s = state[w];
+        if (s.probes < PROBES){ // a probe, the chunk was alone in flight
+            samples.push_back({(double)n, rtt});
+            if (++s.probes == PROBES && !tuned)
+                tune();
+        } else if (tuned && s.lastResult > 0 && n == chunk){
+            // with the window full, results come back every chunk * cost per item
+            double perItem = (now - s.lastResult) / n;
+            costEwma = costEwma > 0 ? 0.8 * costEwma + 0.2 * perItem : perItem;
+            if (costEwma > 1.5 * costPerItem || costEwma < costPerItem / 1.5){
+                costPerItem = costEwma;
+                choose();
+                retunes++;
+            }
+        }
+        s.lastResult = now;
+    }
+
+private:
+    /*
+        Dynamic scheduling: the next chunk (if any)
+    */
+    bool nextChunk(size_t w, assignment& a){
+        if ((!chunk && !autoChunk) || nextItem >= totalItems) // static scheduling or nothing left
+            return false;
+        size_t size = chunk;
+        if (autoChunk && state[w].probesSent < PROBES && !tuned)
+            size = std::min(probeSize(state[w].probesSent++), maxChunk());
+        else if (!size) // probing is over for this worker but no choice yet: keep the largest probe size
+            size = std::min(probeSize(PROBES - 1), maxChunk());
+        size_t end = std::min(nextItem + size, totalItems);
+        a = {w, nextItem, end, false};
+        nextItem = end;
+        return true;
+    }
+
+    /*
+        Locality aware assignment of a partition: the worker gets the next partition it holds. If it has none left, it takes the last one
+        of the worker with the longest backlog, provided the backlog is longer than the locality delay and the input can be moved.
+        The moved partition is owned by the new worker from now on.
+    */
+    bool nextPartition(size_t w, assignment& a){
+        bool local = !backlog[w].empty();
+        size_t victim = w;
+        if (!local){
+            if (!movable) return false;
+            for (size_t v = 0; v < backlog.size(); v++){
+                if (isDropped(v) && !backlog[v].empty()){ // nobody else would compute them
+                    victim = v;
+                    break;
+                }
+                if (backlog[v].size() > backlog[victim].size())
+                    victim = v;
+            }
+            if (backlog[victim].size() <= localityDelay && !isDropped(victim)) return false;
+        }
+
+        size_t p;
+        if (local){
+            p = backlog[w].front();
+            backlog[w].pop_front();
+            localAssignments++;
+        } else {
+            p = backlog[victim].back();
+            backlog[victim].pop_back();
+            (*partitions)[p].owner = w;
+            remoteAssignments++;
+        }
+
+        const DPartition& part = (*partitions)[p];
+        a = {w, part.begin_i, part.end_i, !local};
+        return true;
+    }
+
+    bool isDropped(size_t w) const {
+        return w < dropped.size() && dropped[w];
+    }
+
+    static size_t probeSize(size_t i){
+        return PROBE_FIRST << (2 * i);
+    }
+
+    // at least 4 chunks per worker are left for load balancing
+    size_t maxChunk() const {
+        return std::max<size_t>(1, totalItems / (4 * std::max<size_t>(nWorkers, 1)));
+    }
+
+    /*
+        Least squares fit of the probes: round trip = overhead + items * costPerItem
+    */
+    void tune(){
+        double n = samples.size(), sx = 0, sy = 0, sxx = 0, sxy = 0;
+        for (const auto& [x, y] : samples){
+            sx += x; sy += y; sxx += x * x; sxy += x * y;
+        }
+        double den = n * sxx - sx * sx;
+        costPerItem = den > 0 ? (n * sxy - sx * sy) / den : 0;
+        overhead = (sy - costPerItem * sx) / n;
+        if (costPerItem <= 0) costPerItem = 1e-3; // no measurable cost: 1 ns per item
+        if (overhead < 0) overhead = 0;
+        tuned = true;
+        choose();
+    }
+
+    /*
+        Smallest chunk with overhead / (overhead + chunk * costPerItem) <= overheadTarget, and enough chunks in flight to cover the overhead
+    */
+    void choose(){
+        double best = overhead * (1 - overheadTarget) / (overheadTarget * costPerItem);
+        chunk = std::min(std::max<size_t>(1, (size_t)std::ceil(best)), maxChunk());
+        window = std::min<size_t>(8, 1 + (size_t)std::ceil(overhead / (chunk * costPerItem)));
+    }
+
+    size_t totalItems = 0, nWorkers = 0;
+    size_t chunk = 0;       // 0 => static scheduling
+    size_t preassign = PREASSIGNSIZE;
+    size_t window = PREASSIGNSIZE; // chunks (or partitions) in flight per worker
+    std::vector<size_t> inFlight;
+    size_t nextItem = 0;    // dynamic scheduling: first item not assigned yet
+    size_t staticChunk = 0; // static scheduling: block of each worker
+    std::vector<double> weights; // static scheduling on estimated costs: prefix sum of the costs
+    std::vector<size_t> bounds;  // and first item of each block (nWorkers + 1 entries)
+    std::vector<DPartition>* partitions = nullptr;
+    std::vector<std::deque<size_t>> backlog; // per worker, indexes of its partitions not assigned yet
+    bool movable = true;   // a partition can be computed by a worker not holding it
+    std::vector<bool> dropped;        // workers that will never compute
+    std::deque<assignment> orphans;   // static blocks of the dropped workers, not assigned yet
+    size_t localityDelay = 0;
+
+    // auto chunk size
+    struct workerState {
+        size_t probesSent = 0, probes = 0; // probe chunks sent to and completed by the worker
+        double lastResult = 0;
+    };
+    bool autoChunk = false, tuned = false;
+    double overheadTarget = 0.05;
+    double overhead = 0, costPerItem = 0, costEwma = 0; // microseconds
+    std::map<size_t, double> sentAt; // begin_i -> dispatch time of the chunks in flight
+    std::map<size_t, workerState> state;
+    std::vector<std::pair<double, double>> samples; // probes: (items, round trip)
+};
+
+#endif
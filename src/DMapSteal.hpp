@@ -0,0 +1,129 @@
+#include <network.hpp>
+#include <csignal>
+#include <mutex>
+#include <vector>
+
+#ifndef DMAPSTEAL_H
+#define DMAPSTEAL_H
+
+/*
+    Work stealing state of a worker, shared by the worker node (which computes the block it holds chunk by chunk) and the receiver
+    (which serves the steal requests of the peers and the replies to the requests of this worker).
+
+    The block is the range [next, end) of the current task: the worker node takes chunks from the front, a thief takes the second half
+    from the back. Stolen chunks travel directly between the workers, the master only receives the results as usual.
+*/
+template<typename T>
+class DStealState : protected frameWriter {
+public:
+    ~DStealState(){
+        for (int sck : links)
+            if (sck >= 0) close(sck);
+    }
+
+    bool enabled() const { return !peers.addrs.empty(); }
+
+    /*
+        (receiver) Work stealing is enabled for this map: open a connection to every peer
+    */
+    int setPeers(const DPeers& p){
+        // a peer may terminate while a request to it is in flight, its closed socket must not kill this process
+        signal(SIGPIPE, SIG_IGN);
+
+        peers = p;
+        links.assign(peers.addrs.size(), -1);
+        for (size_t i = 0; i < peers.addrs.size(); i++)
+            if (i != peers.id && (links[i] = tryConnect(peers.addrs[i])) < 0){
+                error("Error connecting to the peer %s\n", peers.addrs[i].c_str());
+                return -1;
+            }
+        return 0;
+    }
+
+    /*
+        (worker node) A new block to compute, either the initial one or a stolen one
+    */
+    void install(Dtask<T>* task){
+        {
+            std::lock_guard<std::mutex> lock(linkMtx);
+            tried = 0;
+        }
+        std::lock_guard<std::mutex> lock(mtx);
+        block = task;
+        next = 0;
+        end = task->end_i - task->begin_i;
+    }
+
+    /*
+        (worker node) The next chunk [begin, end) of the block (as indexes of the task data), false once the block is over.
+        From then on the block is not touched by the receiver anymore and can be deleted.
+    */
+    bool take(size_t& chunkBegin, size_t& chunkEnd){
+        std::lock_guard<std::mutex> lock(mtx);
+        if (next >= end){
+            block = nullptr;
+            return false;
+        }
+        chunkBegin = next;
+        chunkEnd = next = std::min(next + peers.chunk, end);
+        return true;
+    }
+
+    /*
+        (worker node, receiver) Ask the next peer for work. Peers are tried round robin starting from the following one;
+        once all of them refused, the worker stays idle until the master ends the map.
+    */
+    void request(){
+        std::lock_guard<std::mutex> lock(linkMtx);
+        if (tried + 1 >= peers.addrs.size()) return;
+        size_t victim = (peers.id + 1 + tried++) % peers.addrs.size();
+        size_t thief = peers.id;
+        sendToSck(links[victim], &thief, FRAME_STEAL, false); // the peer may have terminated already
+    }
+
+    /*
+        (receiver) The peer thief is idle: give it the second half of the remaining block, if there are at least two chunks left
+    */
+    void onSteal(size_t thief){
+        Dtask<T>* loot;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (block && end - next >= 2 * peers.chunk){
+                size_t split = end - (end - next) / 2;
+                loot = new Dtask<T>(thief, block->begin_i + split, block->begin_i + end,
+                                    block->data.begin() + split, block->data.begin() + end);
+                DTRACE(loot->times = block->times;)
+                end = split;
+            } else
+                loot = new Dtask<T>(thief, 0, 0);
+        }
+
+        std::lock_guard<std::mutex> lock(linkMtx);
+        sendToSck(links[thief], loot, FRAME_STOLEN, false);
+        delete loot;
+    }
+
+    /*
+        (receiver) Reply to a request of this worker: the stolen block to compute, or nullptr if the peer refused (the next one is asked)
+    */
+    Dtask<T>* onStolen(Dtask<T>* loot){
+        if (loot->begin_i < loot->end_i)
+            return loot;
+        delete loot;
+        request();
+        return nullptr;
+    }
+
+private:
+    DPeers peers;
+    std::vector<int> links; // connection to each peer, -1 for this worker
+
+    std::mutex mtx; // protects the block
+    Dtask<T>* block = nullptr;
+    size_t next = 0, end = 0;
+
+    std::mutex linkMtx; // serializes the frames written on the links (requests from the worker node, replies from the receiver)
+    size_t tried = 0;   // peers that refused since the last stolen block
+};
+
+#endif
@@ -0,0 +1,200 @@
+#include <ff/ff.hpp>
+#include <network.hpp>
+#include <DMapMaster.hpp>
+#include <vector>
+#include <map>
+#include <type_traits>
+
+#ifndef DMAPSTREAMMASTER_H
+#define DMAPSTREAMMASTER_H
+
+/*
+    chunk size used by the streaming master when 0 is given, since static scheduling is not possible without knowing the input length
+*/
+#define DEFAULT_STREAM_CHUNK 1024
+
+/*
+    Sink wrapper asking the streaming master to deliver results in input order. At most window chunks wait in the reorder buffer:
+    when it is full the scheduler stops dispatching new chunks until the missing one arrives, so memory stays O(window).
+*/
+template<typename Sink>
+struct OrderedSink {
+    Sink sink;
+    size_t window;
+
+    template<typename T>
+    void operator()(size_t index, T& item){
+        sink(index, item);
+    }
+};
+
+template<typename Sink>
+struct is_ordered_sink : std::false_type {};
+
+template<typename Sink>
+struct is_ordered_sink<OrderedSink<Sink>> : std::true_type {};
+
+/*
+    Master of a streaming map. The input is pulled from a Source (bool operator()(Tin&), returning false when the stream is over) and
+    chunks are cut on the fly, so at most PREASSIGNSIZE chunks per worker are alive on the master at any time.
+    Results are handed to a Sink (void operator()(size_t index, Tout&)) as soon as they come back, in completion order,
+    or in input order if the sink is an OrderedSink.
+*/
+template<typename Tin, typename Tout, typename Source, typename Sink, typename Env = void>
+class DMapStreamMaster : public ff::ff_pipeline{
+private:
+
+    // private class implementing the streaming scheduler
+    struct scheduler : public ff_node_t<Dtask<Tout>, Dtask<Tin>> {
+        bool boot = true;
+        Source source;
+        Sink sink;
+        std::map<int,int> pCount;
+
+        static constexpr bool ordered = is_ordered_sink<Sink>::value;
+        std::map<size_t, Dtask<Tout>*> reorderBuffer; // results waiting for a preceding one, keyed on begin_i
+        std::vector<size_t> throttled;                // workers left without a chunk because the reorder buffer is full
+
+        scheduler(Source _source, Sink _sink, size_t _workers, size_t _chunk_size)
+            : source(std::move(_source)), sink(std::move(_sink)), workers(_workers), chunk_size(_chunk_size && _chunk_size != CHUNK_AUTO ? _chunk_size : DEFAULT_STREAM_CHUNK) {
+                for(size_t i = 0; i < workers; i++)
+                    pCount[i] = 0;
+            }
+
+        /*
+            Pull the next chunk out of the source, nullptr if the source is exhausted
+        */
+        Dtask<Tin>* cut(size_t worker){
+            if (exhausted) return nullptr;
+
+            Dtask<Tin>* task = new Dtask<Tin>;
+            task->id_worker = worker;
+            task->begin_i = nextItemToSend;
+            task->data.reserve(chunk_size);
+
+            Tin item;
+            while (task->data.size() < chunk_size && (exhausted = !source(item)) == false)
+                task->data.push_back(std::move(item));
+
+            if (task->data.empty()){
+                delete task;
+                return nullptr;
+            }
+
+            task->end_i = task->begin_i + task->data.size();
+            nextItemToSend = task->end_i;
+            return task;
+        }
+
+        /*
+            Cut and send a new chunk to the given worker, returns false if there is nothing left to send
+        */
+        bool dispatch(size_t worker){
+            Dtask<Tin>* task = cut(worker);
+            if (!task) return false;
+            inFlight++;
+            this->ff_send_out(task);
+            return true;
+        }
+
+        /*
+            Hand the results of a chunk to the sink
+        */
+        void emit(Dtask<Tout>* result){
+            for (size_t i = 0; i < result->data.size(); i++)
+                sink(result->begin_i + i, result->data[i]);
+            delete result;
+        }
+
+        /*
+            Buffer a result and emit every result that is now contiguous with the already emitted ones.
+            The worker gets a new chunk only if the buffer has room, otherwise it waits until the buffer is drained.
+        */
+        void reorder(Dtask<Tout>* result){
+            size_t worker = result->id_worker;
+            reorderBuffer[result->begin_i] = result;
+
+            if (reorderBuffer.size() < sink.window)
+                dispatch(worker);
+            else
+                throttled.push_back(worker);
+
+            while (!reorderBuffer.empty() && reorderBuffer.begin()->first == nextItemToEmit){
+                nextItemToEmit = reorderBuffer.begin()->second->end_i;
+                emit(reorderBuffer.begin()->second);
+                reorderBuffer.erase(reorderBuffer.begin());
+            }
+
+            while (!throttled.empty() && reorderBuffer.size() < sink.window){
+                dispatch(throttled.back());
+                throttled.pop_back();
+            }
+        }
+
+        Dtask<Tin>* svc(Dtask<Tout>* in){
+            // this if branch is executed just once, in particular during startup to fill workers with tasks
+            if (boot){
+                this->Tstart = getusec(); // start taking time
+                boot = false; delete in;
+
+                for (int i = 0 ; i < PREASSIGNSIZE; i++)
+                    for (size_t w = 0; w < workers; w++)
+                        if (!dispatch(w)) break;
+
+                // empty stream
+                if (inFlight == 0)
+                    return this->EOS;
+
+                return this->GO_ON;
+            }
+
+            #ifdef VERBOSE
+                std::cout << "Received a result" << std::endl;
+            #endif
+
+            // count a new task completed for the specific worker, debug purposes only
+            pCount[in->id_worker]++;
+            processedItems += (in->end_i - in->begin_i);
+            inFlight--;
+
+            if constexpr (ordered)
+                reorder(in);
+            else {
+                // keep the worker busy before consuming the result
+                dispatch(in->id_worker);
+                emit(in);
+            }
+
+            // the source is over and every chunk came back (the reorder buffer is necessarily empty at this point)
+            if (inFlight == 0){
+                std::cout << "Elapsed time: " << (getusec()-(this->Tstart))/1000 << " ms - Streamed " << processedItems << " items" << std::endl;
+
+                for (auto [worker, partitions] : pCount)
+                    std::cout << "Worker #" << worker << " received " << partitions << "partitions" << std::endl;
+
+                // the computation is over, send the End of stream to all the workers
+                return this->EOS;
+            }
+
+            return this->GO_ON;
+        }
+
+        private:
+            bool exhausted = false;
+            size_t workers, chunk_size;
+            size_t nextItemToSend = 0, nextItemToEmit = 0, processedItems = 0, inFlight = 0;
+            size_t Tstart;
+    };
+
+public:
+    DMapStreamMaster(std::string master_addr, std::vector<std::string> worker_addresses, Source source, Sink sink, Env* e = nullptr, size_t chunk_size = 0, const DMapConfig& cfg = DMapConfig()) {
+        // create the stages for the Master pipeline
+        sender<Tin, Env>* s = new sender<Tin, Env>(0, worker_addresses, e);
+        if (cfg.compression) s->setCompression(cfg.compressionLinkMBs);
+        this->add_stage(new receiver<Tout>(master_addr, worker_addresses.size(), true), true);
+        this->add_stage(new scheduler(std::move(source), std::move(sink), worker_addresses.size(), chunk_size), true);
+        this->add_stage(s, true);
+    }
+};
+
+#endif
@@ -0,0 +1,147 @@
+#include <ff/ff.hpp>
+#include <network.hpp>
+#include <DMapConfig.hpp>
+#include <map>
+#include <mutex>
+#include <vector>
+#include <type_traits>
+
+#ifndef DMAPSUBMASTER_H
+#define DMAPSUBMASTER_H
+
+/*
+    Node-local sub-master of a two level topology. To the root master it is a single worker; it splits every chunk received from the root
+    among the worker processes of its node and sends back one aggregated result per chunk, so the root handles one connection and
+    one message per node instead of per worker process.
+
+    It runs two pipelines sharing the table of the chunks in progress:
+        root -> receiver -> splitter -> sender -> local workers
+        local workers -> receiver -> aggregator -> sender -> root
+*/
+template<typename Tin, typename Tout, typename Env = void>
+class DMapSubMaster {
+private:
+
+    // root chunks waiting for some of their parts, keyed on begin_i
+    struct table {
+        struct entry {
+            Dtask<Tout>* result;
+            size_t missing; // parts not computed yet
+        };
+        std::mutex mtx;
+        std::map<size_t, entry> chunks;
+    };
+
+    // private class splitting a root chunk in one part per local worker
+    struct splitter : public ff::ff_node_t<Dtask<Tin>> {
+        table& pending;
+        size_t workers;
+        size_t nextWorker = 0; // rotates the first worker, so chunks smaller than the number of workers are spread as well
+
+        splitter(table& _pending, size_t _workers) : pending(_pending), workers(_workers) {}
+
+        Dtask<Tin>* svc(Dtask<Tin>* in){
+            size_t size = in->end_i - in->begin_i;
+            size_t parts = std::min(workers, size);
+            if (parts == 0){ // nothing to compute, the root does not wait for it
+                delete in;
+                return this->GO_ON;
+            }
+
+            // the container of the aggregated result, elements are not touched yet
+            Dtask<Tout>* result = new Dtask<Tout>(in->id_worker, in->begin_i, in->end_i);
+            result->data.resize(size);
+            DTRACE(result->times = in->times;)
+            {
+                std::lock_guard<std::mutex> lock(pending.mtx);
+                pending.chunks[in->begin_i] = {result, parts};
+            }
+
+            size_t part = (size + parts - 1) / parts; // fast ceiling positive numbers
+            for (size_t start = 0; start < size; start += part){
+                size_t end = std::min(start + part, size);
+                this->ff_send_out(new Dtask<Tin>(nextWorker, in->begin_i + start, in->begin_i + end, in->data.begin() + start, in->data.begin() + end));
+                nextWorker = (nextWorker + 1) % workers;
+            }
+
+            delete in;
+            return this->GO_ON;
+        }
+    };
+
+    // private class collecting the parts of a root chunk, the chunk goes back to the root once complete
+    struct aggregator : public ff::ff_node_t<Dtask<Tout>> {
+        table& pending;
+
+        aggregator(table& _pending) : pending(_pending) {}
+
+        Dtask<Tout>* svc(Dtask<Tout>* in){
+            Dtask<Tout>* complete = nullptr;
+            {
+                std::lock_guard<std::mutex> lock(pending.mtx);
+                auto chunk = std::prev(pending.chunks.upper_bound(in->begin_i));
+                Dtask<Tout>* result = chunk->second.result;
+                DTRACE(
+                    // the chunk is computed from the start of its first part to the end of its last one
+                    if (!result->times.computeStart || in->times.computeStart < result->times.computeStart)
+                        result->times.computeStart = in->times.computeStart;
+                    result->times.computeEnd = std::max(result->times.computeEnd, in->times.computeEnd);
+                )
+                std::move(in->data.begin(), in->data.end(), result->data.begin() + (in->begin_i - result->begin_i));
+                if (--chunk->second.missing == 0){
+                    complete = result;
+                    pending.chunks.erase(chunk);
+                }
+            }
+
+            delete in;
+            return complete ? complete : this->GO_ON;
+        }
+    };
+
+    table pending;
+    ff::ff_pipeline down, up;
+    Env* env = nullptr;
+    DFileRange outputFile;
+
+public:
+    /*
+        listen_addr: where the root connects to, master_addr: the root, local_addr: where the local workers connect to
+    */
+    DMapSubMaster(std::string listen_addr, std::string master_addr, std::string local_addr, std::vector<std::string> local_workers, const DMapConfig& cfg = DMapConfig()){
+        if constexpr (!std::is_void<Env>::value)
+            env = new Env;
+
+        // root -> local workers. The environment arrives from the root after the connections are set up, so it is forwarded lazily
+        receiver<Tin, Env>* r = new receiver<Tin, Env>(listen_addr, 1, false, &env);
+        sender<Tin, Env>* s = new sender<Tin, Env>(0, local_workers, env);
+        s->forwardEnv();
+        down.add_stage(r, true);
+        down.add_stage(new splitter(pending, local_workers.size()), true);
+        down.add_stage(s, true);
+
+        // local workers -> root. If the root shared an output file, the aggregated results are written here.
+        // Only this link leaves the node, so only its frames may be compressed
+        sender<Tout>* rs = new sender<Tout>(0, master_addr);
+        if (cfg.compression) rs->setCompression(cfg.compressionLinkMBs);
+        rs->setHello(listen_addr);
+        r->setOutputFileTarget(&outputFile);
+        rs->setResultFile(&outputFile);
+        up.add_stage(new receiver<Tout>(local_addr, local_workers.size(), false), true);
+        up.add_stage(new aggregator(pending), true);
+        up.add_stage(rs, true);
+    }
+
+    ~DMapSubMaster(){
+        if constexpr (!std::is_void<Env>::value)
+            delete env;
+    }
+
+    int run_and_wait_end(){
+        if (up.run() < 0 || down.run() < 0)
+            return -1;
+        return (down.wait() < 0 || up.wait() < 0) ? -1 : 0;
+    }
+};
+
+#endif
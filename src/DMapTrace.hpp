@@ -0,0 +1,205 @@
+#include <chrono>
+#include <string>
+#include <limits>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <tuple>
+
+#ifndef DMAPTRACE_H
+#define DMAPTRACE_H
+
+/*
+    Per-chunk instrumentation, compiled in with -DTRACE (make TRACE=1). Every task carries a DChunkTimes record that each stage stamps as the
+    chunk travels: the scheduler when it dispatches it, the worker receiver, the worker node and the worker sender, then the master receiver
+    when the result is back. The scheduler keeps the completed records in a ring and prints a summary at the end of the map (and writes
+    them to DMapConfig::traceFile, if set).
+    Without TRACE the record does not exist and DTRACE(...) expands to nothing, so neither the tasks nor the frames change.
+*/
+#ifdef TRACE
+    #define DTRACE(...) __VA_ARGS__
+#else
+    #define DTRACE(...)
+#endif
+
+// number of chunk records kept by the scheduler, older ones are overwritten
+#ifndef TRACE_RECORDS
+    #define TRACE_RECORDS (1 << 16)
+#endif
+
+/*
+    Microseconds from the monotonic clock: stamps taken by different processes of the same node are comparable, the ones of different
+    nodes are only compared as differences taken on the same node
+*/
+inline uint64_t traceNow(){
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct DChunkTimes {
+    uint64_t dispatch = 0;                   // (master) the scheduler sends the chunk
+    uint64_t workerRecv = 0;                 // (worker) the chunk is deserialized
+    uint64_t computeStart = 0, computeEnd = 0;
+    uint64_t workerSend = 0;                 // (worker) the result is being serialized
+    uint64_t masterRecv = 0;                 // (master) the result is deserialized
+    uint64_t bytesOut = 0, bytesIn = 0;      // frame sizes master -> worker and worker -> master
+
+    template <class Archive>
+    void serialize(Archive& ar){
+        ar(dispatch, workerRecv, computeStart, computeEnd, workerSend, masterRecv, bytesOut, bytesIn);
+    }
+};
+
+struct DChunkRecord {
+    size_t worker, begin_i, end_i;
+    DChunkTimes times;
+};
+
+/*
+    Fixed size ring of the completed chunks, written by the scheduler thread only: recording a chunk is a copy into a preallocated slot
+*/
+class DTraceRing {
+public:
+    DTraceRing(size_t capacity = TRACE_RECORDS) : slots(capacity) {}
+
+    void push(const DChunkRecord& record){
+        slots[next++ % slots.size()] = record;
+    }
+
+    // the records kept, oldest first
+    std::vector<DChunkRecord> records() const {
+        std::vector<DChunkRecord> result;
+        for (size_t i = (next > slots.size() ? next - slots.size() : 0); i < next; i++)
+            result.push_back(slots[i % slots.size()]);
+        return result;
+    }
+
+    size_t dropped() const { return next > slots.size() ? next - slots.size() : 0; }
+
+    /*
+        Summary of a map lasting elapsed microseconds: per worker busy time and idle gaps between its chunks, and where the round trip
+        time of the chunks went (compute, worker queues and serialization, network and master side)
+    */
+    void report(uint64_t elapsed) const {
+        struct workerStats { size_t chunks = 0; uint64_t compute = 0, idle = 0, maxGap = 0; std::vector<const DChunkRecord*> byStart; };
+        std::vector<DChunkRecord> all = records();
+        std::map<size_t, workerStats> workers;
+        uint64_t bytesOut = 0, bytesIn = 0, roundTrip = 0, compute = 0, atWorker = 0;
+
+        for (const DChunkRecord& r : all){
+            const DChunkTimes& t = r.times;
+            workerStats& w = workers[r.worker];
+            w.chunks++;
+            w.compute += t.computeEnd - t.computeStart;
+            w.byStart.push_back(&r);
+            bytesOut += t.bytesOut;
+            bytesIn += t.bytesIn;
+            if (t.dispatch && t.masterRecv >= t.dispatch){ // stolen chunks have no round trip of their own
+                roundTrip += t.masterRecv - t.dispatch;
+                compute += t.computeEnd - t.computeStart;
+                atWorker += t.workerSend - t.workerRecv;
+            }
+        }
+
+        std::printf("Trace: %zu chunks (%zu dropped), %.2f MB sent, %.2f MB received\n", all.size(), dropped(), bytesOut / 1e6, bytesIn / 1e6);
+        for (auto& [id, w] : workers){
+            std::sort(w.byStart.begin(), w.byStart.end(), [](const DChunkRecord* a, const DChunkRecord* b){ return a->times.computeStart < b->times.computeStart; });
+            for (size_t i = 1; i < w.byStart.size(); i++)
+                if (w.byStart[i]->times.computeStart > w.byStart[i-1]->times.computeEnd){
+                    uint64_t gap = w.byStart[i]->times.computeStart - w.byStart[i-1]->times.computeEnd;
+                    w.idle += gap;
+                    w.maxGap = std::max(w.maxGap, gap);
+                }
+            std::printf("Worker #%zu: %zu chunks, compute %.2f ms, utilization %.1f%%, idle gaps %.2f ms (max %.2f ms)\n", id, w.chunks,
+                        w.compute / 1e3, elapsed ? 100.0 * w.compute / elapsed : 0.0, w.idle / 1e3, w.maxGap / 1e3);
+        }
+        if (roundTrip)
+            std::printf("Round trip share: compute %.1f%% - worker queues %.1f%% - network and master %.1f%%\n", 100.0 * compute / roundTrip,
+                        100.0 * (atWorker - compute) / roundTrip, 100.0 * (roundTrip - atWorker) / roundTrip);
+    }
+
+    /*
+        Write the chunks as a Chrome trace event file (chrome://tracing, ui.perfetto.dev): one process per worker, with the compute, queue
+        and network slices of its chunks on the master timeline. The clock offset of each worker is estimated as NTP does: the dispatch,
+        worker receive, worker send and master receive stamps of a chunk are the four stamps of an exchange, and the exchange with the
+        shortest network delay gives the best estimate.
+    */
+    int dump(const std::string& path) const {
+        std::vector<DChunkRecord> all = records();
+        std::map<size_t, int64_t> offset, delay;
+        uint64_t origin = std::numeric_limits<uint64_t>::max();
+        for (const DChunkRecord& r : all){
+            const DChunkTimes& t = r.times;
+            if (!t.dispatch || !t.masterRecv) continue;
+            origin = std::min(origin, t.dispatch);
+            int64_t d = ((int64_t)t.masterRecv - (int64_t)t.dispatch) - ((int64_t)t.workerSend - (int64_t)t.workerRecv);
+            if (!delay.count(r.worker) || d < delay[r.worker]){
+                delay[r.worker] = d;
+                offset[r.worker] = (((int64_t)t.workerRecv - (int64_t)t.dispatch) + ((int64_t)t.workerSend - (int64_t)t.masterRecv)) / 2;
+            }
+        }
+
+        // worker stamps moved to the master clock, everything relative to the first dispatch
+        struct event { const DChunkRecord* r; int kind; const char* name; int64_t from, to; uint64_t bytes; int tid; };
+        std::vector<event> events;
+        for (const DChunkRecord& r : all){
+            if (!offset.count(r.worker)) continue;
+            const DChunkTimes& t = r.times;
+            auto master = [&](uint64_t ts){ return (int64_t)ts - (int64_t)origin; };
+            auto worker = [&](uint64_t ts){ return (int64_t)ts - offset[r.worker] - (int64_t)origin; };
+            events.push_back({&r, 1, "receive", master(t.dispatch), worker(t.workerRecv), t.bytesOut, 0});
+            events.push_back({&r, 3, "wait compute", worker(t.workerRecv), worker(t.computeStart), 0, 0});
+            events.push_back({&r, 0, "compute", worker(t.computeStart), worker(t.computeEnd), 0, 0});
+            events.push_back({&r, 3, "wait send", worker(t.computeEnd), worker(t.workerSend), 0, 0});
+            events.push_back({&r, 2, "send", worker(t.workerSend), master(t.masterRecv), t.bytesIn, 0});
+        }
+
+        // with several chunks in flight the network and queue slices of consecutive chunks overlap, which the viewers cannot draw on
+        // one thread: each kind of slice gets as many lanes (tid = kind + 4 * lane) as the chunks it has at the same time
+        std::sort(events.begin(), events.end(), [](const event& a, const event& b){
+            return std::make_tuple(a.r->worker, a.kind, a.from) < std::make_tuple(b.r->worker, b.kind, b.from);
+        });
+        std::map<size_t, std::map<int, std::vector<int64_t>>> laneEnds; // worker -> kind -> end of the last slice of each lane
+        for (event& e : events){
+            e.to = std::max(e.to, e.from);
+            std::vector<int64_t>& ends = laneEnds[e.r->worker][e.kind];
+            size_t lane = std::find_if(ends.begin(), ends.end(), [&](int64_t end){ return end <= e.from; }) - ends.begin();
+            if (lane == ends.size())
+                ends.push_back(e.to);
+            ends[lane] = e.to;
+            e.tid = e.kind + 4 * (int)lane;
+        }
+
+        FILE* f = std::fopen(path.c_str(), "w");
+        if (!f) return -1;
+        std::fprintf(f, "{\"traceEvents\":[\n");
+        bool first = true;
+        const char* threads[] = {"compute", "network in", "network out", "queues"};
+        for (const auto& [worker, kinds] : laneEnds){
+            std::fprintf(f, "%s{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%zu,\"args\":{\"name\":\"Worker #%zu\"}}", first ? "" : ",\n", worker, worker);
+            for (const auto& [kind, ends] : kinds)
+                for (size_t lane = 0; lane < ends.size(); lane++){
+                    std::string name = threads[kind] + (ends.size() > 1 ? " " + std::to_string(lane + 1) : "");
+                    std::fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%zu,\"tid\":%d,\"args\":{\"name\":\"%s\"}}", worker,
+                                 kind + 4 * (int)lane, name.c_str());
+                }
+            first = false;
+        }
+
+        for (const event& e : events){
+            std::fprintf(f, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%zu,\"tid\":%d,\"ts\":%lld,\"dur\":%lld,\"args\":{\"begin\":%zu,\"end\":%zu,\"bytes\":%llu}}",
+                         first ? "" : ",\n", e.name, e.r->worker, e.tid, (long long)e.from, (long long)(e.to - e.from), e.r->begin_i, e.r->end_i,
+                         (unsigned long long)e.bytes);
+            first = false;
+        }
+        std::fprintf(f, "\n]}\n");
+        return std::fclose(f) == 0 ? 0 : -1;
+    }
+
+private:
+    std::vector<DChunkRecord> slots;
+    size_t next = 0;
+};
+
+#endif
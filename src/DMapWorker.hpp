@@ -1,9 +1,13 @@
 #include <ff/ff.hpp>
 #include <ff/parallel_for.hpp>
+#include <ff/mapper.hpp>
 #include <type_traits>
 #include <functional>
 #include <iostream>
 #include <network.hpp>
+#include <DMapConfig.hpp>
+#include <DMapDataset.hpp>
+#include <DMapSteal.hpp>
 
 template<typename Tin, typename Tout, typename Env = void>
 class DMapWorker : public ff::ff_pipeline{
@@ -13,34 +17,111 @@ private:
         ff::ParallelFor pf;
         Env* env;
         int threads; // number of thread to be used in the parallel for
+        ssize_t inputDataset = -1, outputDataset = -1; // resident datasets the input is read from and the output is stored to (-1 => none)
+        DStealState<Tin>* steal = nullptr;
         worker(std::function<Tout(Tin&, Env*)> transform_, int wth) : transformer(transform_), pf(wth), threads(wth) {
             if constexpr (!std::is_void<Env>::value)
                 env = new Env;
         }
 
-        Dtask<Tout>* svc(Dtask<Tin>* in){
-
-            // create the container for the results, copying some metadata from the received task
-            Dtask<Tout>* out = new Dtask<Tout>(*in);
-
-
+        /*
+            Compute the items of src starting from offset into out
+        */
+        void compute(Dtask<Tin>* src, size_t offset, Dtask<Tout>* out){
             /* This is used to simulate unbalanced workers
             if (in->id_worker < 4)
                 threads = 4;
                 */
             
             
-            this->pf.parallel_for(0, (in->end_i - in->begin_i),    // start, stop indexes
+            // grain 0 => static scheduling with one contiguous block per thread, so each (pinned) thread always
+            // computes the same portion of the chunk and is the first one touching the corresponding output pages
+            this->pf.parallel_for_static(0, out->data.size(), 1, 0,    // start, stop indexes, step, grain
                        [&](const long i)  {
-                                out->data[i] = transformer(in->data[i], (this->env));
+                                out->data[i] = transformer(src->data[offset + i], (this->env));
                         }, threads);
+        }
+
+        /*
+            Work stealing: compute the block chunk by chunk (a thief may take its tail meanwhile), then become a thief
+        */
+        Dtask<Tout>* stealingSvc(Dtask<Tin>* in){
+            steal->install(in);
+            size_t b, e;
+            while (steal->take(b, e)){
+                Dtask<Tout>* out = new Dtask<Tout>(in->id_worker, in->begin_i + b, in->begin_i + e);
+                out->data.resize(e - b);
+                DTRACE(out->times = in->times; out->times.computeStart = traceNow();)
+                compute(in, b, out);
+                DTRACE(out->times.computeEnd = traceNow();)
+                this->ff_send_out(out);
+            }
+            delete in;
+
+            steal->request();
+            return this->GO_ON;
+        }
+
+        Dtask<Tout>* svc(Dtask<Tin>* in){
+            if (steal && steal->enabled())
+                return stealingSvc(in);
+
+            // the input partition is resident in this worker, the master sent only its range (the data comes along if the partition was moved here)
+            Dtask<Tin>* src = in;
+            if (inputDataset >= 0 && in->data.empty() && !(src = DResidentStore::instance().get<Tin>(inputDataset, in->begin_i))){
+                error("Partition [%zu, %zu) is not resident in this worker\n", in->begin_i, in->end_i);
+                exit(EXIT_FAILURE);
+            }
+
+            // create the container for the results, copying some metadata from the received task (the elements are not touched yet)
+            Dtask<Tout>* out = new Dtask<Tout>(in->id_worker, in->begin_i, in->end_i);
+            out->data.resize(in->end_i - in->begin_i);
+
+            DTRACE(out->times = in->times; out->times.computeStart = traceNow();)
+            compute(src, 0, out);
+            DTRACE(out->times.computeEnd = traceNow();)
 
             delete in;
+
+            // keep the output partition here and acknowledge just its range
+            if (outputDataset >= 0){
+                DResidentStore::instance().put(outputDataset, out);
+                Dtask<Tout>* ack = new Dtask<Tout>(out->id_worker, out->begin_i, out->end_i);
+                DTRACE(ack->times = out->times;)
+                return ack;
+            }
             return out;
         }
     };
 
-    void construct(){
+    /*
+        Number of compute threads, pinning the ParallelFor pool threads if a topology was given
+    */
+    static int computeThreads(const DMapConfig& cfg, int wth){
+        std::vector<int> cpus = cfg.computeCpus();
+        if (cpus.empty())
+            return wth;
+
+        std::string mapping;
+        for (size_t i = 0; i < cpus.size(); i++)
+            mapping += (i ? "," : "") + std::to_string(cpus[i]);
+        ff::threadMapper::instance()->setMappingList(mapping.c_str());
+
+        return (wth == FF_AUTO) ? (int)cpus.size() : wth;
+    }
+
+    void construct(const std::string& listen_addr){
+        // the worker introduces itself to the master with its listen address
+        this->s->setHello(listen_addr);
+
+        // the output file shared by the master (if any) flows from the receiver to the sender
+        this->r->setOutputFileTarget(&(this->outputFile));
+        this->s->setResultFile(&(this->outputFile));
+
+        // work stealing frames (if the master enables it) are served by the receiver
+        this->r->setStealState(&(this->steal));
+        this->w->steal = &(this->steal);
+
         // create the pipeline from the already created stages
         this->add_stage(this->r, true);
         this->add_stage(this->w, true);
@@ -50,18 +131,29 @@ private:
     worker* w;
     receiver<Tin, Env>* r;
     sender<Tout>* s;
+    DFileRange outputFile;
+    DStealState<Tin> steal;
 
 public:
 
+    /*
+        Read the input from (and/or store the output to) resident datasets of this process, -1 => none
+    */
+    void setResidentDatasets(ssize_t inputDataset, ssize_t outputDataset){
+        this->w->inputDataset = inputDataset;
+        this->w->outputDataset = outputDataset;
+    }
+
     /*
         This constructor is invoked when a function that takes also the environment is used
     */
-    DMapWorker(Tout(*transform_)(Tin&, Env*), std::string listen_addr, std::string master_addr, int wth = FF_AUTO){
+    DMapWorker(Tout(*transform_)(Tin&, Env*), std::string listen_addr, std::string master_addr, int wth = FF_AUTO, const DMapConfig& cfg = DMapConfig()){
         // create the worker
-        this->w = new worker(transform_, wth);
-        this->r = new receiver<Tin, Env>(listen_addr, 1, false, &(this->w->env));
-        this->s = new sender<Tout>(0, master_addr);
-        construct();
+        this->w = new worker(transform_, computeThreads(cfg, wth));
+        this->r = new receiver<Tin, Env>(listen_addr, 1, false, &(this->w->env), cfg.receiverCpu());
+        this->s = new sender<Tout>(0, master_addr, nullptr, cfg.senderCpu());
+        if (cfg.compression) this->s->setCompression(cfg.compressionLinkMBs);
+        construct(listen_addr);
     }
 
     /*
@@ -69,10 +161,11 @@ public:
 
         The function is wrapped on another function discarding an environmet pointer (i.e. the function is decorated)
     */
-    DMapWorker(Tout(*transform_)(Tin&), std::string listen_addr,  std::string master_addr, int wth = FF_AUTO){
-        this->w = new worker(([transform_](Tin& in, void*) -> Tout {return transform_(in);}), wth);
-        this->r = new receiver<Tin, Env>(listen_addr, 1);
-        this->s = new sender<Tout>(0, master_addr);
-        construct();
+    DMapWorker(Tout(*transform_)(Tin&), std::string listen_addr,  std::string master_addr, int wth = FF_AUTO, const DMapConfig& cfg = DMapConfig()){
+        this->w = new worker(([transform_](Tin& in, void*) -> Tout {return transform_(in);}), computeThreads(cfg, wth));
+        this->r = new receiver<Tin, Env>(listen_addr, 1, false, nullptr, cfg.receiverCpu());
+        this->s = new sender<Tout>(0, master_addr, nullptr, cfg.senderCpu());
+        if (cfg.compression) this->s->setCompression(cfg.compressionLinkMBs);
+        construct(listen_addr);
     }
 };
@@ -7,16 +7,32 @@
 #include <sys/uio.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <thread>
+#include <chrono>
 #include <cmath>
 #include <string>
+#include <memory>
+#include <fstream>
+#include <atomic>
+#include <mutex>
+#include <map>
+#include <deque>
+#include <algorithm>
 
 #include <cereal/cereal.hpp>
 #include <cereal/types/polymorphic.hpp>
 #include <cereal/types/vector.hpp> 
 #include <cereal/types/array.hpp>
+#include <cereal/types/string.hpp>
 #include <cereal/archives/portable_binary.hpp>
 
+#include <DMapTrace.hpp>
+#include <DMapMetrics.hpp>
+#include <DMapCompress.hpp>
+#include <DMapColumnar.hpp>
+
 #ifndef DMAPNETWORK_H
 #define DMAPNETWORK_H
 
@@ -28,6 +44,262 @@
 
 using namespace ff;
 
+/*
+    Allocator that default-initializes (instead of value-initializing) the elements of a vector. For trivial types the memory is
+    left untouched at allocation time, so its pages are first touched, and thus placed on the NUMA node, by the thread that writes them.
+*/
+template<typename T, typename A = std::allocator<T>>
+struct default_init_allocator : public A {
+    template<typename U>
+    struct rebind {
+        using other = default_init_allocator<U, typename std::allocator_traits<A>::template rebind_alloc<U>>;
+    };
+
+    using A::A;
+
+    template<typename U>
+    void construct(U* ptr) noexcept(std::is_nothrow_default_constructible<U>::value) {
+        ::new(static_cast<void*>(ptr)) U;
+    }
+
+    template<typename U, typename... Args>
+    void construct(U* ptr, Args&&... args) {
+        std::allocator_traits<A>::construct(static_cast<A&>(*this), ptr, std::forward<Args>(args)...);
+    }
+};
+
+/*
+    Kind of a frame exchanged between sender and receiver. It is the first field of the header of each frame.
+*/
+enum DFrameType : uint32_t {
+    FRAME_DATA = 0, // a Dtask (or the EOS when the size is 0)
+    FRAME_ENV  = 1, // the environment
+    FRAME_FILE = 2, // the descriptor of an input file that the workers read by themselves
+    FRAME_OUTFILE = 3, // the descriptor of an output file that the workers write by themselves
+    FRAME_PEERS = 4,  // (work stealing) the list of the workers, sent by the master
+    FRAME_STEAL = 5,  // (work stealing) request of work from an idle worker to a peer
+    FRAME_STOLEN = 6, // (work stealing) reply to a steal request: a Dtask, with an empty range if the peer had nothing to give
+    FRAME_HELLO = 7,  // first frame of a worker to the master, carrying the worker listen address
+    FRAME_LEAVE = 8   // (elastic map) the worker wants to leave once its current chunks are done
+};
+
+/*
+    Flag of the frame type: the payload is <original size, 4 bytes> followed by the original payload compressed with DCompress.
+    Any receiver accepts compressed frames, whether the sender compresses is its own choice (see DMapConfig::compression).
+*/
+#define FRAME_COMPRESSED 0x80000000u
+
+/*
+    Markers travelling in the range of a Dtask from the receiver to the scheduler (and from the scheduler to the sender) of the master:
+    the worker id_worker joined, is leaving, or could not be reached back and will never compute
+*/
+#define MARK_JOIN  ((size_t)-1)
+#define MARK_LEAVE ((size_t)-2)
+#define MARK_DROP  ((size_t)-3)
+
+inline bool isPreconnected(const std::string& addr);
+
+/*
+    Workers of a map as they connect, indexed by worker id. The listed workers (command line) get their index in the list when they
+    introduce themselves; in an elastic map other workers are admitted as well, in order of arrival. Filled by the master receiver,
+    which also connects back to the joined workers; the sender takes the connections from here.
+*/
+class DMembership {
+public:
+    DMembership(std::vector<std::string> listed = {}, bool _open = false)
+        : addrs(std::move(listed)), states(addrs.size(), FREE), sockets(addrs.size(), -1), open(_open) {}
+
+    /*
+        Id of the worker listening on addr, or -1 if it is not admitted. A listed worker may spell its address differently from the
+        command line of the master (e.g. localhost for 127.0.0.1): it gets the slot of the listed address resolving to the same endpoint,
+        and is reached back on the address it introduced. Any other worker is admitted only by an elastic map.
+    */
+    ssize_t join(const std::string& addr){
+        std::lock_guard<std::mutex> lock(mtx);
+        ssize_t id = slot([&](const std::string& listed){ return listed == addr; });
+        if (id < 0 && !isPreconnected(addr))
+            id = slot([&](const std::string& listed){ return sameEndpoint(listed, addr); });
+        if (id >= 0){
+            addrs[id] = addr;
+            states[id] = JOINED;
+            return id;
+        }
+        if (!open)
+            return -1;
+        addrs.push_back(addr);
+        states.push_back(JOINED);
+        sockets.push_back(-1);
+        return addrs.size() - 1;
+    }
+
+    std::string addr(size_t id){
+        std::lock_guard<std::mutex> lock(mtx);
+        return addrs[id];
+    }
+
+    // the master is connected to the joined worker id through sck
+    void connected(size_t id, int sck){
+        std::lock_guard<std::mutex> lock(mtx);
+        sockets[id] = sck;
+    }
+
+    // the connection to worker id, -1 if there is none or it was already taken
+    int take(size_t id){
+        std::lock_guard<std::mutex> lock(mtx);
+        int sck = sockets[id];
+        sockets[id] = -1;
+        return sck;
+    }
+
+    // the connections not taken yet
+    std::vector<int> takeAll(){
+        std::lock_guard<std::mutex> lock(mtx);
+        std::vector<int> result;
+        for (int& sck : sockets)
+            if (sck >= 0){
+                result.push_back(sck);
+                sck = -1;
+            }
+        return result;
+    }
+
+    // the joined worker id cannot be reached: it does not count as joined, and its slot is not given to anybody else
+    void drop(size_t id){
+        std::lock_guard<std::mutex> lock(mtx);
+        states[id] = DROPPED;
+    }
+
+    // number of workers joined so far
+    size_t size(){
+        std::lock_guard<std::mutex> lock(mtx);
+        return std::count(states.begin(), states.end(), JOINED);
+    }
+
+    // workers listed on the command line (and admitted so far, in an elastic map)
+    size_t listed(){
+        std::lock_guard<std::mutex> lock(mtx);
+        return addrs.size();
+    }
+
+    // every listed worker has either joined or been dropped
+    bool complete(){
+        std::lock_guard<std::mutex> lock(mtx);
+        return std::count(states.begin(), states.end(), FREE) == 0;
+    }
+
+    bool isOpen() const { return open; }
+
+    // the scheduler completed the map, no other worker is admitted
+    void finish(){ finished = true; }
+    bool isFinished() const { return finished; }
+
+private:
+    enum state : char { FREE, JOINED, DROPPED };
+
+    std::mutex mtx;
+    std::vector<std::string> addrs;
+    std::vector<state> states;
+    std::vector<int> sockets;
+    bool open;
+    std::atomic<bool> finished{false};
+
+    template<typename Match>
+    ssize_t slot(Match match){
+        for (size_t i = 0; i < addrs.size(); i++)
+            if (states[i] == FREE && match(addrs[i]))
+                return i;
+        return -1;
+    }
+
+    static std::string port(const std::string& addr){
+        size_t colon = addr.rfind(':');
+        return colon == std::string::npos ? std::string() : addr.substr(colon + 1);
+    }
+
+    // host:port addresses resolving to a common endpoint
+    static bool sameEndpoint(const std::string& a, const std::string& b){
+        #ifdef REMOTE
+            if (port(a).empty() || port(a) != port(b))
+                return false;
+            auto resolve = [](const std::string& addr){
+                std::vector<std::string> endpoints;
+                struct addrinfo hints, *result;
+                memset(&hints, 0, sizeof(hints));
+                hints.ai_family = AF_UNSPEC;
+                hints.ai_socktype = SOCK_STREAM;
+                if (getaddrinfo(addr.substr(0, addr.rfind(':')).c_str(), port(addr).c_str(), &hints, &result) != 0)
+                    return endpoints;
+                for (struct addrinfo* rp = result; rp; rp = rp->ai_next)
+                    endpoints.emplace_back((const char*)rp->ai_addr, rp->ai_addrlen);
+                freeaddrinfo(result);
+                return endpoints;
+            };
+            std::vector<std::string> ea = resolve(a), eb = resolve(b);
+            for (const auto& e : ea)
+                if (std::find(eb.begin(), eb.end(), e) != eb.end())
+                    return true;
+        #endif
+        return false;
+    }
+};
+
+/*
+    Set (e.g. by a signal handler) to let a worker of an elastic map leave once its current chunks are done
+*/
+inline std::atomic<bool>& leaveRequested(){
+    static std::atomic<bool> flag(false);
+    return flag;
+}
+
+/*
+    File made of fixed size records, accessible by every worker (shared filesystem or local run).
+    When the master shares it as input, tasks carry just the [begin_i, end_i) range and each worker reads the records at offset + begin_i*sizeof(T) on its own.
+    When the master shares it as output, each worker writes its results at the same offsets and sends back just the range. Results that are not
+    trivially copyable are instead serialized into a segment file per chunk, named segmentPath(path, begin_i).
+*/
+struct DFileRange {
+    std::string path;
+    size_t offset = 0; // bytes to skip at the beginning of the file
+    size_t items = 0;  // number of records
+
+    template <class Archive>
+    void serialize( Archive & ar ){
+        ar(path, offset, items);
+    }
+};
+
+/*
+    Granularity of work stealing (items) when the map is called with chunk size 0
+*/
+#define DEFAULT_STEAL_CHUNK 1024
+
+/*
+    The workers of a map with work stealing, as seen by one of them: the worker computes its block in chunks of chunk items
+    and, once done, steals directly from its peers (addrs[i] is the listen address of worker i, id is the receiving worker).
+*/
+struct DPeers {
+    size_t id = 0;
+    size_t chunk = 0;
+    std::vector<std::string> addrs;
+
+    template <class Archive>
+    void serialize( Archive & ar ){
+        ar(id, chunk, addrs);
+    }
+};
+
+template<typename T>
+class DStealState; // defined in DMapSteal.hpp
+
+/*
+    Name of the segment file holding the results of the chunk starting at begin_i. Indexes are zero padded so segments sort in input order.
+*/
+std::string segmentPath(const std::string& path, size_t begin_i){
+    char idx[32];
+    snprintf(idx, sizeof(idx), ".%020zu", begin_i);
+    return path + idx;
+}
+
 /*
     Struct representing the task that are sent to/from workers. This struct must be serializable to be sent on the network.
 */
@@ -35,7 +307,8 @@ template<typename T>
 struct Dtask {
     size_t id_worker; 
     size_t begin_i, end_i; // range of where is collocated the sub-task in the original collection
-    std::vector<T> data; 
+    std::vector<T, default_init_allocator<T>> data; 
+    DTRACE(DChunkTimes times;)
 
     Dtask() = default;
 
@@ -45,27 +318,72 @@ struct Dtask {
     template<typename Iterator>
     Dtask(size_t worker, size_t begin, size_t end, Iterator first, Iterator last) : id_worker(worker), begin_i(begin), end_i(end), data(first, last) {}
 
-    /* 
-        This constructor is used when a result is created, it copies the metadata from the original input task
+    /*
+        This constructor is used when the worker reads the data of the range by itself, only the range is sent.
     */
-    template<typename TT>
-    Dtask(const Dtask<TT>& m){
-        this->id_worker = m.id_worker;
-        this->begin_i = m.begin_i;
-        this->end_i = m.end_i;
-        this->data = std::vector<T>(this->end_i - this->begin_i); // allocate a vector of size (end_i - begin_i)
-    }
+    Dtask(size_t worker, size_t begin, size_t end) : id_worker(worker), begin_i(begin), end_i(end) {}
 
     /*
-        Ceral's serialization function
+        Ceral's serialization function. The data goes in the columnar encoding if enabled for T (see DColumnar)
     */
     template <class Archive>
     void serialize( Archive & ar ){
-        ar( id_worker, begin_i, end_i, data);
+        if constexpr (DColumnar<T>::enabled)
+            ar( id_worker, begin_i, end_i, DColumnarData<T, default_init_allocator<T>>{data});
+        else
+            ar( id_worker, begin_i, end_i, data);
+        DTRACE(ar(times);)
     }
 
 };
 
+/*
+    Results computed inside the master process (see DMapMaster::setLocalWorker): queued by the local worker and handed to the scheduler by
+    the master receiver, which is woken up through a pipe as it were one more connection.
+*/
+template<typename T>
+class DLocalChannel {
+public:
+    DLocalChannel(){
+        if (pipe(fds) < 0)
+            ff::error("Error creating the local channel");
+    }
+
+    ~DLocalChannel(){
+        for (int fd : fds)
+            if (fd >= 0) close(fd);
+    }
+
+    // (local worker) queue a result and wake up the receiver
+    void push(Dtask<T>* task){
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            queue.push_back(task);
+        }
+        char c = 0;
+        if (write(fds[1], &c, 1) < 0)
+            ff::error("Error writing on the local channel");
+    }
+
+    // (receiver) the results queued so far, to be called when fd() is readable
+    std::deque<Dtask<T>*> drain(){
+        char buffer[64];
+        if (read(fds[0], buffer, sizeof(buffer)) < 0)
+            ff::error("Error reading from the local channel");
+        std::deque<Dtask<T>*> results;
+        std::lock_guard<std::mutex> lock(mtx);
+        results.swap(queue);
+        return results;
+    }
+
+    int fd() const { return fds[0]; }
+
+private:
+    int fds[2] = {-1, -1};
+    std::mutex mtx;
+    std::deque<Dtask<T>*> queue;
+};
+
 /*
     stringbuf implementation which avoid an extra copy when create it from a raw char c array.
     Mainly useful when receving from network and immediately after start deserializing.
@@ -100,6 +418,13 @@ protected:
 	bool cleanup = false;
 };
 
+/*
+    Addresses "fd:<n>[,<n>...]" name socket descriptors already connected by the local launcher (see DMap::Exec) instead of endpoints to connect to
+*/
+inline bool isPreconnected(const std::string& addr){
+    return addr.rfind("fd:", 0) == 0;
+}
+
 /*
     Helper function to split strings by a delimiter char
 */
@@ -115,6 +440,12 @@ std::vector<std::string> split (const std::string &s, char delim) {
     return result;
 }
 
+/*
+    (master receiver) Connect to the listen address of a joined worker, retrying like the senders do (-1 on failure), and send the
+    EOS on such a connection. Defined after frameWriter.
+*/
+inline int connectWorker(const std::string& addr, DCounter* retries);
+inline int sendEOSFrame(int sck);
 
 /*
     Netowrk receiver node
@@ -157,18 +488,43 @@ private:
         }
     }
 
+    /*
+        Read the records of the range of a task from the shared input file
+    */
+    int readRange(Dtask<Tout>* task){
+        if constexpr (std::is_trivially_copyable<Tout>::value){
+            size_t len = (task->end_i - task->begin_i) * sizeof(Tout);
+            off_t off = inputFile.offset + task->begin_i * sizeof(Tout);
+            task->data.resize(task->end_i - task->begin_i);
+
+            char* ptr = (char*)task->data.data();
+            while (len > 0){
+                ssize_t r = pread(inputFd, ptr, len, off);
+                if (r <= 0){
+                    error("Error reading the input file %s\n", inputFile.path.c_str());
+                    return -1;
+                }
+                ptr += r; off += r; len -= r;
+            }
+            return 0;
+        } else {
+            error("File input requires trivially copyable elements\n");
+            return -1;
+        }
+    }
+
     /*
         The main function which handle a network request coming from the file descriptor sck. 
         Here is performed the deserialization and the dispatching of data to the next stage.
      */
     int handleRequest(int sck){
-		bool isEnv;
+		uint32_t type;
         size_t sz;
 
         // create the iovector representing our micro-protocol. Refer to receiver & sender section of the report.
         struct iovec iov[2];
-        iov[0].iov_base = &isEnv;
-        iov[0].iov_len = sizeof(isEnv);
+        iov[0].iov_base = &type;
+        iov[0].iov_len = sizeof(type);
         iov[1].iov_base = &sz;
         iov[1].iov_len = sizeof(sz);
 
@@ -178,8 +534,9 @@ private:
         }
 
         // convert values to host byte order
-        isEnv  = ntohl(isEnv);
+        type   = ntohl(type);
         sz     = ntohl(sz);
+        if (metrics) metrics->bytesReceived.add(sizeof(type) + sizeof(sz) + sz);
 
         // if the size is greater than zero it means that there is data to read and also that is not an EOS flag.
         if (sz > 0){
@@ -191,14 +548,36 @@ private:
                 delete [] buff;
                 return -1;
             }
+
+            // a compressed payload is expanded before the de-serialization
+            size_t len = sz;
+            if (type & FRAME_COMPRESSED){
+                type &= ~FRAME_COMPRESSED;
+                uint32_t original = 0;
+                char* plain = nullptr;
+                if (sz >= sizeof(original)){
+                    memcpy(&original, buff, sizeof(original));
+                    original = ntohl(original);
+                    plain = new char[original];
+                }
+                if (!plain || !DDecompress(buff + sizeof(original), sz - sizeof(original), plain, original)){
+                    error("Error decompressing a frame");
+                    delete [] plain;
+                    delete [] buff;
+                    return -1;
+                }
+                delete [] buff;
+                buff = plain;
+                len = original;
+            }
             
             // create the stream to perform the de-serialization
-            dataBuffer strBuff(buff, sz, true); // <-- Zero copy here. See the dataBuffer definition.
+            dataBuffer strBuff(buff, len, true); // <-- Zero copy here. See the dataBuffer definition.
             std::istream iss(&strBuff);
 			cereal::PortableBinaryInputArchive iarchive(iss);
 
             // the received data structure represents an environment
-            if (isEnv){
+            if (type == FRAME_ENV){
                 // if the Environment is not void (it is actually void when the environment feature is not used, it is known at compile time)
                 if constexpr (!std::is_void<Env>::value){
                     #ifdef VERBOSE
@@ -209,11 +588,60 @@ private:
                         iarchive >> **envptr;
                     
                 }
+            } else if (type == FRAME_OUTFILE){ // the results will be written to a file by the sender of this worker
+                if (outputFile)
+                    iarchive >> *outputFile;
+            } else if (type == FRAME_HELLO){ // a worker introduces itself and joins the computation (the master can send it tasks from now on)
+                std::string addr;
+                iarchive >> addr;
+                ssize_t id;
+                if (members && !members->isFinished()){
+                    if ((id = members->join(addr)) < 0){
+                        error("Worker %s is not part of this map\n", addr.c_str());
+                        return -1; // drop the connection, the worker is not waited for
+                    }
+                    memberOf[sck] = id;
+                    connectBack(id);
+                }
+            } else if (type == FRAME_LEAVE){ // the worker on sck leaves after its current chunks
+                if (members && memberOf.count(sck))
+                    this->ff_send_out(new Dtask<Tout>(memberOf[sck], MARK_LEAVE, MARK_LEAVE));
+            } else if (type == FRAME_PEERS){ // work stealing is enabled, connect to the other workers
+                DPeers peers;
+                iarchive >> peers;
+                if (steal && steal->setPeers(peers) < 0)
+                    return -1;
+            } else if (type == FRAME_STEAL){ // a peer is idle, give it part of the remaining work
+                size_t thief;
+                iarchive >> thief;
+                if (steal)
+                    steal->onSteal(thief);
+            } else if (type == FRAME_STOLEN){ // reply to a steal request of this worker
+                Dtask<Tout>* data = new Dtask<Tout>;
+                iarchive >> *data;
+                if (steal && (data = steal->onStolen(data)))
+                    this->ff_send_out(data);
+            } else if (type == FRAME_FILE){ // the input will be read from a file
+                iarchive >> inputFile;
+                if ((inputFd = open(inputFile.path.c_str(), O_RDONLY)) < 0){
+                    error("Error opening the input file %s\n", inputFile.path.c_str());
+                    return -1;
+                }
             } else { // it is a task (i.e. Data)
                 // create a task container
                 Dtask<Tout>* data = new Dtask<Tout>;
                 // de-serialize the data into the task
                 iarchive >> *data;
+                // just the range was sent, read the records from the input file
+                if (inputFd >= 0 && data->data.empty() && readRange(data) < 0){
+                    delete data;
+                    return -1;
+                }
+                if (metrics) metrics->resultsReceived.add(1);
+                DTRACE(
+                    if (isMaster){ data->times.masterRecv = traceNow(); data->times.bytesIn = sz; }
+                    else { data->times.workerRecv = traceNow(); data->times.bytesOut = sz; }
+                )
                 // send it to the next stage
                 this->ff_send_out(data);
             }
@@ -223,6 +651,9 @@ private:
 
         // if size == 0 => EOS
          _neos++; // increment the eos received
+        // a worker stops accepting connections before propagating the last EOS, so it is closed before the master can start another map
+        if (!isMaster && _neos == input_channels)
+            stopListening();
         #ifdef VERBOSE
             std::cout << "Received EOS!" << std::endl;
         #endif           
@@ -237,6 +668,14 @@ public:
     int svc_init() {
   		if (coreid!=-1)
 			ff_mapThreadToCpu(coreid);
+
+        // already connected endpoints inherited from the local launcher, nothing to listen on. They are duplicated, so the
+        // inherited descriptors stay open for the next maps of the program
+        if (isPreconnected(acceptAddr)){
+            for (const std::string& fd : split(acceptAddr.substr(3), ','))
+                preconnected.push_back(dup(std::stoi(fd)));
+            return 0;
+        }
         
         #ifdef LOCAL
             // create an AF_LOCAL socket
@@ -287,13 +726,64 @@ public:
 
         return 0;
     }
-    void svc_end() {
+    /*
+        Where to store the output file descriptor shared by the master (it is then used by the sender of the worker)
+    */
+    void setOutputFileTarget(DFileRange* target){
+        this->outputFile = target;
+    }
+
+    /*
+        (master only) Workers join by introducing themselves, so the scheduler starts with the first one instead of waiting for all of them.
+        The receiver runs until the scheduler completes the map and every joined worker has sent its EOS.
+    */
+    void setMembership(DMembership* m){
+        this->members = m;
+        this->joins.reset(new DLocalChannel<Tout>());
+    }
+
+    /*
+        (master only) The master computes some chunks by itself, their results come from this channel besides the connections
+    */
+    void setLocalChannel(DLocalChannel<Tout>* channel){
+        this->localResults = channel;
+    }
+
+    /*
+        (master only) Count the received frames and results
+    */
+    void setMetrics(DMetrics* m){
+        this->metrics = m;
+    }
+
+    /*
+        (worker only) Where to hand the work stealing frames to
+    */
+    void setStealState(DStealState<Tout>* state){
+        this->steal = state;
+    }
+
+    /*
+        Close the listen socket as soon as every expected peer is connected. A program running several maps in a row binds the same
+        address again for the next map: a peer that is already moving to the next map must not be accepted by this (finishing) receiver.
+    */
+    void stopListening(){
+        if (this->listen_sck < 0) return;
         close(this->listen_sck);
+        this->listen_sck = -1;
 
         #ifdef LOCAL
             unlink(this->acceptAddr.c_str()); // delete the socket file
         #endif
     }
+
+    void svc_end() {
+        stopListening();
+        if (inputFd >= 0)
+            close(inputFd);
+        for (std::thread& t : connectors)
+            t.join();
+    }
     /* 
         Here i should not care of input type nor input data since they come from a socket listener.
         Everything will be handled inside a while true.
@@ -311,13 +801,33 @@ public:
         FD_ZERO(&tmpset);
 
         // add the listen socket to the master set
-        FD_SET(this->listen_sck, &set);
+        if (this->listen_sck >= 0)
+            FD_SET(this->listen_sck, &set);
 
         // hold the greater descriptor
         int fdmax = this->listen_sck; 
+
+        // the endpoints inherited from the local launcher are connected from the beginning
+        for (int fd : preconnected){
+            FD_SET(fd, &set);
+            fdmax = std::max(fdmax, fd);
+            establishedConnections++;
+        }
+        if (localResults){
+            FD_SET(localResults->fd(), &set);
+            fdmax = std::max(fdmax, localResults->fd());
+        }
+        if (joins){
+            FD_SET(joins->fd(), &set);
+            fdmax = std::max(fdmax, joins->fd());
+        }
+        if (isMaster && !members && !preconnected.empty() && establishedConnections == input_channels){
+            this->ff_send_out(new Dtask<Tout>());
+            boot = false;
+        }
         
         // iterate untill i get exactly the number of input_channels EOS flags
-        while(_neos < input_channels){
+        while(members ? !(members->isFinished() && _neos == members->size()) : _neos < input_channels){
 
             // copy the master set to the temporary
             tmpset = set;
@@ -331,6 +841,23 @@ public:
             // iterate over the file descriptor to see which one is active
             for(int i=0; i <= fdmax; i++) 
 	            if (FD_ISSET(i, &tmpset)){
+                    // results computed by the master itself
+                    if (localResults && i == localResults->fd()){
+                        for (Dtask<Tout>* result : localResults->drain()){
+                            DTRACE(result->times.masterRecv = traceNow();)
+                            if (metrics) metrics->resultsReceived.add(1);
+                            this->ff_send_out(result);
+                        }
+                        continue;
+                    }
+
+                    // a connection back to a joined worker is done (or failed)
+                    if (joins && i == joins->fd()){
+                        for (Dtask<Tout>* marker : joins->drain())
+                            joined(marker, set, tmpset, establishedConnections);
+                        continue;
+                    }
+
                     // if the socket active is the listen socket, it means there is a new connection to accept
                     if (i == this->listen_sck) {
                         int connfd = accept(this->listen_sck, (struct sockaddr*)NULL ,NULL);
@@ -340,8 +867,13 @@ public:
                             FD_SET(connfd, &set);
                             if(connfd > fdmax) fdmax = connfd;
                             establishedConnections++;
+                            // no other worker is expected by the master (workers keep listening for their peers instead)
+                            if (isMaster && !members && establishedConnections == input_channels){
+                                FD_CLR(this->listen_sck, &set);
+                                stopListening();
+                            }
                             // trigger the scheduler if this is the master and i have already all the workers connected - The condition holds only once
-                            if (isMaster && establishedConnections == input_channels && boot){
+                            if (isMaster && !members && establishedConnections == input_channels && boot){
                                 this->ff_send_out(new Dtask<Tout>());
                                 boot = false;
                             }
@@ -353,6 +885,7 @@ public:
                     if (this->handleRequest(i) < 0){
                         close(i);
                         FD_CLR(i, &set);
+                        memberOf.erase(i);
                         establishedConnections--;
                         // update the maximum file descriptor
                         if (i == fdmax)
@@ -362,6 +895,13 @@ public:
                                     break;
                                 }
                     }
+
+                    // every listed worker introduced itself (see stopListening)
+                    if (isMaster && members && !members->isOpen() && this->listen_sck >= 0 && members->complete()){
+                        FD_CLR(this->listen_sck, &set);
+                        FD_CLR(this->listen_sck, &tmpset);
+                        stopListening();
+                    }
                 }
 
         }
@@ -376,11 +916,73 @@ public:
 private:
     size_t _neos = 0;
     size_t input_channels;
-    int listen_sck;
+    int listen_sck = -1;
+    std::vector<int> preconnected; // connections inherited from the local launcher
     std::string acceptAddr;	
 	int coreid;
     bool isMaster;
     Env** envptr;
+    DFileRange inputFile;
+    int inputFd = -1;
+    DFileRange* outputFile = nullptr;
+    DStealState<Tout>* steal = nullptr;
+    DMembership* members = nullptr;
+    DLocalChannel<Tout>* localResults = nullptr;
+    DMetrics* metrics = nullptr;
+    std::map<int, size_t> memberOf; // socket -> id of the joined worker on it
+    std::unique_ptr<DLocalChannel<Tout>> joins; // connections back to the joined workers, as MARK_JOIN / MARK_DROP markers
+    std::vector<std::thread> connectors;
+
+    /*
+        Connect back to the joined worker id on a thread of its own, so that neither the results nor the dispatch to the other
+        workers wait for it. The outcome comes back on the joins channel.
+    */
+    void connectBack(size_t id){
+        DCounter* retries = metrics ? &metrics->retries : nullptr;
+        DMembership* m = members;
+        DLocalChannel<Tout>* channel = joins.get();
+        connectors.emplace_back([id, retries, m, channel]{
+            int sck = connectWorker(m->addr(id), retries);
+            if (sck < 0){
+                error("Error connecting to the joined worker %s\n", m->addr(id).c_str());
+                m->drop(id);
+            } else
+                m->connected(id, sck);
+            size_t mark = sck < 0 ? MARK_DROP : MARK_JOIN;
+            channel->push(new Dtask<Tout>(id, mark, mark));
+        });
+    }
+
+    /*
+        Hand the outcome of a connection back to the scheduler. A worker that cannot be reached is disconnected as well, so that the
+        map does not wait for its EOS; one connected after the end of the map gets the EOS right away.
+    */
+    void joined(Dtask<Tout>* marker, fd_set& set, fd_set& tmpset, size_t& establishedConnections){
+        size_t id = marker->id_worker;
+        if (marker->begin_i == MARK_DROP){
+            for (auto it = memberOf.begin(); it != memberOf.end(); ++it)
+                if (it->second == id){
+                    close(it->first);
+                    FD_CLR(it->first, &set);
+                    FD_CLR(it->first, &tmpset);
+                    establishedConnections--;
+                    memberOf.erase(it);
+                    break;
+                }
+        } else if (members->isFinished()){
+            int sck = members->take(id);
+            if (sck >= 0){
+                if (sendEOSFrame(sck) < 0)
+                    error("Error sending EOS");
+                close(sck);
+            }
+        }
+
+        if (members->isFinished())
+            delete marker;
+        else
+            this->ff_send_out(marker);
+    }
 };
 
 
@@ -389,19 +991,14 @@ private:
 
 
 /*
-    Netowrk sender node
+    Connection and framing helpers shared by everything that writes frames on a socket
 */
-template<typename Tin, typename Env = void>
-class sender: public ff::ff_node_t<Dtask<Tin>> { 
-private:
-    
-    size_t _neos=0;
-    int distibutedGroupId;
-    int next_rr_destination = 0; //next destiation to send for round robin policy
-    std::vector<std::string> destinations;
-    std::map<int, int> sockets;
-	int coreid;
-	Env* env;
+class frameWriter {
+protected:
+    DCounter* sentBytes = nullptr;  // (master sender) bytes of the frames written, if counted
+    DCounter* retryCount = nullptr; // (master sender and connectors) failed connection attempts, if counted
+    std::unique_ptr<DCompressionPolicy> compression; // data frames are compressed when worth it, if set
+    std::vector<char> packed; // compressed payload of the frame being sent
 
     /*
         Create a socket based connection to the specified destination
@@ -409,6 +1006,10 @@ private:
     int create_connect(const std::string& destination){
         int socketFD;
 
+        // endpoint inherited from the local launcher: duplicate it, so that it stays open for the next maps
+        if (isPreconnected(destination))
+            return dup(std::stoi(destination.substr(3)));
+
         #ifdef LOCAL
             // create an AF_LOCAL socket
             socketFD = socket(AF_LOCAL, SOCK_STREAM, 0);
@@ -477,8 +1078,10 @@ private:
         int fd, retries = 0;
         
         // exponential backoff policy of retrying (bounded on the number MAX_RETRIES)
-        while((fd = this->create_connect(destination)) < 0 && ++retries < MAX_RETRIES)
+        while((fd = this->create_connect(destination)) < 0 && ++retries < MAX_RETRIES){
+            if (retryCount) retryCount->addShared(1);
             std::this_thread::sleep_for(std::chrono::milliseconds((long)std::pow(2, retries)));
+        }
 
         return fd;
     }
@@ -517,11 +1120,26 @@ private:
         }
     }
 
+    /*
+        Send the EOS frame <FRAME_DATA, 0>
+    */
+    int sendEOS(int sck){
+        size_t sz = htonl(0);
+        uint32_t type = htonl(FRAME_DATA);
+
+        struct iovec iov[2];
+        iov[0].iov_base = &type;
+        iov[0].iov_len = sizeof(type);
+        iov[1].iov_base = &sz;
+        iov[1].iov_len = sizeof(sz);
+        return writevn(sck, iov, 2) <= 0 ? -1 : 0;
+    }
+
     /* 
-        Serialize an object and send it over the specified socket 
+        Serialize an object and send it over the specified socket (errors are silent with reportErrors false, e.g. when the peer may be gone)
     */
     template<typename T>
-    int sendToSck(int sck, T* task, bool isEnv_ = false){
+    int sendToSck(int sck, T* task, uint32_t type_ = FRAME_DATA, bool reportErrors = true){
         
         // allocate the buffer
         dataBuffer buff;
@@ -530,29 +1148,132 @@ private:
 		// serialize the object 
         oarchive << *task;
 
+        // compress the tasks, if enabled and worth it (kept only if it saves at least 1/8 of the bytes)
+        const char* payload = buff.getPtr();
+        size_t len = buff.getLen();
+        uint32_t original = 0;
+        if (compression && (type_ == FRAME_DATA || type_ == FRAME_STOLEN) && compression->shouldCompress(len)){
+            packed.resize(len - len / 8);
+            auto start = std::chrono::steady_clock::now();
+            size_t packedLen = DCompress(payload, len, packed.data(), packed.size());
+            compression->compressed(len, packedLen, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+            if (packedLen){
+                original = htonl(len);
+                payload = packed.data();
+                len = packedLen;
+                type_ |= FRAME_COMPRESSED;
+            }
+        }
+
         // convert variables to netowrk byte order
-        size_t sz = htonl(buff.getLen());
-        bool isEnv = htonl(isEnv_);
+        size_t sz = htonl(len + (original ? sizeof(original) : 0));
+        uint32_t type = htonl(type_);
 
         // create the iovector representing our micro-protocol. Refer to receiver & sender section of the report.
-        struct iovec iov[2];
-        iov[0].iov_base = &isEnv;
-        iov[0].iov_len = sizeof(isEnv);
+        struct iovec iov[3];
+        iov[0].iov_base = &type;
+        iov[0].iov_len = sizeof(type);
         iov[1].iov_base = &sz;
         iov[1].iov_len = sizeof(sz);
+        iov[2].iov_base = &original;
+        iov[2].iov_len = sizeof(original);
 
         // write the iovector 
-        if (writevn(sck, iov, 2) < 0){
-            error("Error writing on socket");
+        auto start = std::chrono::steady_clock::now();
+        if (writevn(sck, iov, original ? 3 : 2) < 0){
+            if (reportErrors) error("Error writing on socket");
             return -1;
         }
 
         // write the buffer (i.e. data)
-        if (writen(sck, buff.getPtr(), buff.getLen()) < 0){
-            error("Error writing on socket");
+        if (writen(sck, payload, len) < 0){
+            if (reportErrors) error("Error writing on socket");
             return -1;
         }
+        if (compression)
+            compression->written(len, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+
+        if (sentBytes) sentBytes->add(sizeof(type) + sizeof(sz) + (original ? sizeof(original) : 0) + len);
+        return 0;
+    }
+};
+
+inline int connectWorker(const std::string& addr, DCounter* retries){
+    struct connector : frameWriter {
+        int connect(const std::string& addr, DCounter* retries){
+            this->retryCount = retries;
+            return tryConnect(addr);
+        }
+    } c;
+    return c.connect(addr, retries);
+}
+
+inline int sendEOSFrame(int sck){
+    struct eos : frameWriter {
+        int send(int sck){ return sendEOS(sck); }
+    } e;
+    return e.send(sck);
+}
+
+/*
+    Netowrk sender node
+*/
+template<typename Tin, typename Env = void>
+class sender: public ff::ff_node_t<Dtask<Tin>>, protected frameWriter { 
+private:
+    
+    size_t _neos=0;
+    int distibutedGroupId;
+    int next_rr_destination = 0; //next destiation to send for round robin policy
+    std::vector<std::string> destinations;
+    std::map<int, int> sockets;
+	int coreid;
+	Env* env;
+    DFileRange inputFile; // shared with the workers if the path is not empty
+    DFileRange outputFile; // shared with the workers if the path is not empty
+    size_t stealChunk = 0; // work stealing granularity sent to the workers, 0 => no work stealing
+    bool envOnFirstTask = false; // (sub-master) the environment is sent together with the first task instead of at connection time
+    DMembership* members = nullptr; // (master only) workers are connected when they join
+    DMetrics* metrics = nullptr;    // (master only) live counters
+    std::string hello; // (worker only) listen address introduced to the master
+    bool leaveSent = false;
+    const DFileRange* resultFile = nullptr; // (worker only) results are written here if the master shared an output file
+    int resultFd = -1;
+
+    /*
+        Write the results of a task into the output file (or into its own segment file) and drop them from the task,
+        so that only the range is sent back as acknowledgement
+    */
+    int writeResults(Dtask<Tin>* task){
+        if constexpr (std::is_trivially_copyable<Tin>::value){
+            if (resultFd < 0 && (resultFd = open(resultFile->path.c_str(), O_WRONLY | O_CREAT, 0644)) < 0){
+                error("Error opening the output file %s\n", resultFile->path.c_str());
+                return -1;
+            }
+            
+            const char* ptr = (const char*)task->data.data();
+            size_t len = task->data.size() * sizeof(Tin);
+            off_t off = resultFile->offset + task->begin_i * sizeof(Tin);
+            while (len > 0){
+                ssize_t w = pwrite(resultFd, ptr, len, off);
+                if (w <= 0){
+                    error("Error writing the output file %s\n", resultFile->path.c_str());
+                    return -1;
+                }
+                ptr += w; off += w; len -= w;
+            }
+        } else {
+            std::ofstream segment(segmentPath(resultFile->path, task->begin_i), std::ios::binary | std::ios::trunc);
+            if (!segment){
+                error("Error creating the segment file of %s\n", resultFile->path.c_str());
+                return -1;
+            }
+            cereal::PortableBinaryOutputArchive oarchive(segment);
+            oarchive << task->data;
+        }
 
+        task->data.clear();
+        task->data.shrink_to_fit();
         return 0;
     }
 
@@ -573,43 +1294,189 @@ public:
 		: distibutedGroupId(dGroup_id), destinations(std::move(destinations_v)),coreid(coreid), env(env_ptr) {
         }
 
+    /*
+        Send to a newly connected worker everything it needs before the first task
+    */
+    int greet(size_t id, int sck){
+        // the environment if present - This information is known at compile time
+        if constexpr (!std::is_void<Env>::value){
+            if (env != nullptr && !envOnFirstTask && sendToSck(sck, env, FRAME_ENV) < 0)
+                return -1;
+        }
+
+        // where to read the input from and where to write the output to
+        if (!inputFile.path.empty() && sendToSck(sck, &inputFile, FRAME_FILE) < 0)
+            return -1;
+        if (!outputFile.path.empty() && sendToSck(sck, &outputFile, FRAME_OUTFILE) < 0)
+            return -1;
+
+        // let the workers steal from each other
+        if (stealChunk > 0){
+            DPeers peers;
+            peers.id = id;
+            peers.chunk = stealChunk;
+            peers.addrs = this->destinations;
+            if (sendToSck(sck, &peers, FRAME_PEERS) < 0)
+                return -1;
+        }
+        return 0;
+    }
+
     int svc_init() {
 		if (coreid!=-1)
 			ff_mapThreadToCpu(coreid);
 		
-        // intialize a persisten connection to all specified destinations
-        for(size_t i=0; i < this->destinations.size(); i++)
-            sockets[i] = tryConnect(this->destinations[i]);
-
-        // send to all the connected worker the environment if present - This information is known at compile time
-        if constexpr (!std::is_void<Env>::value){
-            if (env != nullptr)
-                for (const auto& [_, sck] : sockets){
-                    std::ignore = _;
-                    if (sendToSck(sck, env, true) < 0)
-                        return -1;
-                }
-                    
+        // intialize a persisten connection to all specified destinations (with a membership they are connected once they join)
+        if (!members)
+            for(size_t i=0; i < this->destinations.size(); i++)
+                sockets[i] = tryConnect(this->destinations[i]);
+
+        for (const auto& [i, sck] : sockets){
+            // introduce this worker to the master
+            if (!hello.empty() && sendToSck(sck, &hello, FRAME_HELLO) < 0)
+                return -1;
+            if (greet(i, sck) < 0)
+                return -1;
         }
         
         return 0;
     }
 
+    /*
+        (master only) Connect to the workers when the scheduler admits them, release them when they leave (elastic map)
+    */
+    void setMembership(DMembership* m){
+        this->members = m;
+    }
+
+    /*
+        (worker only) Introduce this worker to the master with its listen address
+    */
+    void setHello(const std::string& listen_addr){
+        this->hello = listen_addr;
+    }
+
+    /*
+        Let the workers read the input from the given file instead of receiving it
+    */
+    void setInputFile(const DFileRange& file){
+        this->inputFile = file;
+    }
+
+    /*
+        Let the workers write the results to the given file instead of sending them back
+    */
+    void setOutputFile(const DFileRange& file){
+        this->outputFile = file;
+    }
+
+    /*
+        Compress the tasks sent when the measured ratio and link throughput make it worth it (linkMBs > 0 fixes the link throughput)
+    */
+    void setCompression(double linkMBs = 0){
+        this->compression.reset(new DCompressionPolicy(linkMBs * 1e6));
+    }
+
+    /*
+        (master only) Count the tasks, bytes and connection retries
+    */
+    void setMetrics(DMetrics* m){
+        this->metrics = m;
+        this->sentBytes = &m->bytesSent;
+        this->retryCount = &m->retries;
+    }
+
+    /*
+        (sub-master) The environment is filled from the upstream master only after connecting: forward it before the first task
+    */
+    void forwardEnv(){
+        this->envOnFirstTask = true;
+    }
+
+    /*
+        Let the workers balance the load by stealing chunks of the given size from each other
+    */
+    void setPeers(size_t chunk){
+        this->stealChunk = chunk;
+    }
+
+    /*
+        (worker only) Write the results to the file described here, once the master has filled it, instead of sending them
+    */
+    void setResultFile(const DFileRange* file){
+        this->resultFile = file;
+    }
+
     void svc_end() {
         // close the socket not matter if local or remote
-        for(size_t i=0; i < this->destinations.size(); i++)
-            close(sockets[i]);    
+        for (const auto& [_, sck] : sockets){
+            std::ignore = _;
+            close(sck);
+        }
+        if (resultFd >= 0)
+            close(resultFd);
     }
 
     Dtask<Tin> *svc(Dtask<Tin>* task) {
+        if constexpr (!std::is_void<Env>::value){
+            if (envOnFirstTask){
+                envOnFirstTask = false;
+                for (const auto& [_, sck] : sockets){
+                    std::ignore = _;
+                    if (env != nullptr && sendToSck(sck, env, FRAME_ENV) < 0)
+                        error("Error forwarding the environment");
+                }
+            }
+        }
+
+        // a worker joined (connect to it) or its last chunk came back after it asked to leave (send it the EOS)
+        if (members && (task->begin_i == MARK_JOIN || task->begin_i == MARK_LEAVE)){
+            size_t id = task->id_worker;
+            bool join = (task->begin_i == MARK_JOIN);
+            delete task;
+            if (join){
+                // connected by the receiver when the worker introduced itself
+                int sck = members->take(id);
+                if (sck >= 0 && greet(id, sck) < 0)
+                    error("Error greeting the joined worker %s\n", members->addr(id).c_str());
+                if (sck >= 0)
+                    sockets[id] = sck;
+            } else if (sockets.count(id)){
+                if (sendEOS(sockets[id]) < 0)
+                    error("Error sending EOS");
+                close(sockets[id]);
+                sockets.erase(id);
+            }
+            return this->GO_ON;
+        }
+
         int sck;
         // workers have just one destination, the master node, so everything must be sent to it
-        if (this->destinations.size() == 1) 
+        if (this->destinations.size() == 1 && !members) 
             sck = sockets[0];
-        else // otherwise send to the right worker (used only by master)
+        else if (sockets.count(task->id_worker)) // otherwise send to the right worker (used only by master)
             sck = sockets[task->id_worker];
+        else {
+            error("No connection to the worker %zu\n", task->id_worker);
+            delete task;
+            return this->GO_ON;
+        }
+
+        // the master shared an output file, the results are written there and only the range goes back
+        if (resultFile && !resultFile->path.empty() && writeResults(task) < 0){
+            error("Cannot write the results, terminating the worker\n");
+            exit(EXIT_FAILURE);
+        }
 
+        DTRACE(if (!hello.empty()) task->times.workerSend = traceNow();)
         sendToSck(sck, task);
+        if (metrics) metrics->tasksSent.add(1);
+
+        // elastic map: the worker leaves once the chunks already assigned to it are done
+        if (!hello.empty() && !leaveSent && leaveRequested()){
+            leaveSent = true;
+            sendToSck(sck, &hello, FRAME_LEAVE);
+        }
 
         delete task;
         return this->GO_ON;
@@ -620,20 +1487,18 @@ public:
     */
      void eosnotify(ssize_t) {
 	    if (++_neos >= 1){
-            size_t sz = htonl(0);
-            bool isEnv = htonl(false);
-
-            // create the iovector for sending <false, 0> 
-            struct iovec iov[2];
-            iov[0].iov_base = &isEnv;
-            iov[0].iov_len = sizeof(isEnv);
-            iov[1].iov_base = &sz;
-            iov[1].iov_len = sizeof(sz);
-            
+            // workers connected while the map was ending, whose join did not reach this node, get the EOS as well
+            if (members)
+                for (int sck : members->takeAll()){
+                    if (sendEOS(sck) < 0)
+                        ff::error("Error sending EOS");
+                    close(sck);
+                }
+
             // send it to all the destinations
             for(const auto &[_, sck] : sockets){
                 std::ignore = _;
-                if (writevn(sck, iov, 2) <= 0)
+                if (sendEOS(sck) < 0)
                     ff::error("Error sending EOS");
             }
             #ifdef VERBOSE
@@ -0,0 +1,180 @@
+#include <DMap.hpp>
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+/*
+    Benchmark driver: sweeps input size, element size, per-item cost distribution, chunk size, scheduling policy and number of workers,
+    repeating every configuration and writing the median and percentiles of the elapsed time to a CSV file. Workers are forked for every
+    run by the local launcher, so it needs no external script:
+
+        $ make LOCAL=1 tests/bench
+        $ ./tests/bench --sizes 10000,100000 --costs uniform,heavy --chunks 64,1024 --workers 1,2,4 --repeats 5 --out bench.csv
+
+    Options (comma separated lists are swept):
+        --sizes      number of items                              (default 100000)
+        --elems      bytes per item: 8, 64, 512 or 4096           (default 8)
+        --costs      uniform, ramp (0 to 2x the mean along the input), heavy (Pareto, alpha 1.5)   (default uniform)
+        --cost-ns    mean cost per item, in nanoseconds           (default 1000)
+        --policies   static, dynamic, master (dynamic with the master computing as well)            (default static,dynamic)
+        --chunks     chunk sizes of the dynamic policies, auto => CHUNK_AUTO   (default 1024)
+        --workers    number of local worker processes             (default 2)
+        --threads    compute threads per worker                   (default 1)
+        --repeats    runs per configuration                       (default 5)
+        --out        CSV file                                     (default bench.csv)
+
+    Work stealing is not swept, since the workers forked by the local launcher have no address their peers can connect to.
+*/
+
+struct options {
+    std::vector<size_t> sizes = {100000}, elems = {8}, chunks = {1024}, workers = {2};
+    std::vector<std::string> costs = {"uniform"}, policies = {"static", "dynamic"};
+    size_t costNs = 1000, threads = 1, repeats = 5;
+    std::string out = "bench.csv";
+};
+
+/*
+    Item of N bytes carrying the cost (ns) of its computation
+*/
+template<size_t N>
+struct item {
+    uint32_t cost = 0;
+    std::array<char, N - sizeof(uint32_t)> payload;
+
+    template <class Archive>
+    void serialize(Archive& ar){
+        ar(cost, payload);
+    }
+};
+
+// busy wait, so the cost is spent on a core as a real computation would
+inline void spin(uint32_t ns){
+    auto end = std::chrono::steady_clock::now() + std::chrono::nanoseconds(ns);
+    while (std::chrono::steady_clock::now() < end);
+}
+
+template<size_t N>
+item<N> work(item<N>& in){
+    spin(in.cost);
+    return in;
+}
+
+/*
+    Cost of item i of n for the given distribution, deterministic so that every repetition computes the same input
+*/
+uint32_t itemCost(const std::string& dist, size_t i, size_t n, size_t mean){
+    if (dist == "ramp")
+        return (uint32_t)(2.0 * mean * i / n);
+    if (dist == "heavy"){
+        // Pareto with alpha 1.5 has mean 3 x_m. The uniform sample comes from a hash of the index; the tail is capped at 1000x the mean
+        double u = ((i * 2654435761u) % 1000003) / 1000003.0;
+        return (uint32_t)std::min(mean / 3.0 * std::pow(1.0 - u, -1.0 / 1.5), 1000.0 * mean);
+    }
+    return (uint32_t)mean;
+}
+
+/*
+    One run of a configuration: forks the workers, maps, returns the elapsed milliseconds on the master (-1 on error).
+    The forked workers run the same code and terminate inside DMap::map.
+*/
+template<size_t N>
+double run(const options& opt, size_t size, const std::string& cost, const std::string& policy, size_t chunk, size_t workers){
+    std::string n = std::to_string(workers);
+    char* argv[] = {(char*)"bench", (char*)"local", (char*)n.c_str(), nullptr};
+    DMap::Exec exec(3, argv);
+    if (policy == "master")
+        exec.masterThreads = opt.threads;
+
+    std::vector<item<N>> input, output;
+    if (exec.isMaster){
+        input.resize(size);
+        output.resize(size);
+        for (size_t i = 0; i < size; i++)
+            input[i].cost = itemCost(cost, i, size, opt.costNs);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    if (DMap::map(exec, work<N>, input.begin(), input.end(), output.begin(), policy == "static" ? 0 : chunk, (void*) nullptr, opt.threads) < 0)
+        return -1;
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+double percentile(std::vector<double> v, double p){
+    std::sort(v.begin(), v.end());
+    size_t rank = (size_t)std::ceil(p / 100.0 * v.size());
+    return v[rank ? rank - 1 : 0];
+}
+
+template<typename T>
+std::vector<T> parseList(const std::string& s){
+    std::vector<T> result;
+    for (const std::string& item : split(s, ','))
+        if constexpr (std::is_same<T, std::string>::value)
+            result.push_back(item);
+        else
+            result.push_back(item == "auto" ? CHUNK_AUTO : std::stoul(item));
+    return result;
+}
+
+int main(int argc, char* argv[]){
+    options opt;
+    for (int i = 1; i + 1 < argc; i += 2){
+        std::string key(argv[i]), value(argv[i + 1]);
+        if (key == "--sizes") opt.sizes = parseList<size_t>(value);
+        else if (key == "--elems") opt.elems = parseList<size_t>(value);
+        else if (key == "--costs") opt.costs = parseList<std::string>(value);
+        else if (key == "--cost-ns") opt.costNs = std::stoul(value);
+        else if (key == "--policies") opt.policies = parseList<std::string>(value);
+        else if (key == "--chunks") opt.chunks = parseList<size_t>(value);
+        else if (key == "--workers") opt.workers = parseList<size_t>(value);
+        else if (key == "--threads") opt.threads = std::stoul(value);
+        else if (key == "--repeats") opt.repeats = std::max<size_t>(std::stoul(value), 1);
+        else if (key == "--out") opt.out = value;
+        else {
+            std::cerr << "Unknown option " << key << std::endl;
+            return 1;
+        }
+    }
+
+    std::ofstream csv(opt.out);
+    csv << "size,elem_bytes,cost,cost_ns,policy,chunk,workers,threads,repeats,median_ms,p10_ms,p90_ms,min_ms,max_ms,items_per_s" << std::endl;
+
+    for (size_t size : opt.sizes)
+    for (size_t elem : opt.elems)
+    for (const std::string& cost : opt.costs)
+    for (const std::string& policy : opt.policies)
+    for (size_t chunk : (policy == "static" ? std::vector<size_t>{0} : opt.chunks))
+    for (size_t workers : opt.workers){
+        std::vector<double> times;
+        for (size_t r = 0; r < opt.repeats; r++){
+            double t;
+            switch (elem){
+                case 8:    t = run<8>(opt, size, cost, policy, chunk, workers); break;
+                case 64:   t = run<64>(opt, size, cost, policy, chunk, workers); break;
+                case 512:  t = run<512>(opt, size, cost, policy, chunk, workers); break;
+                case 4096: t = run<4096>(opt, size, cost, policy, chunk, workers); break;
+                default:
+                    std::cerr << "Unsupported element size " << elem << std::endl;
+                    return 1;
+            }
+            if (t < 0){
+                std::cerr << "Run failed" << std::endl;
+                return 1;
+            }
+            times.push_back(t);
+        }
+
+        double median = percentile(times, 50);
+        std::string chunkName = chunk == CHUNK_AUTO ? "auto" : std::to_string(chunk);
+        csv << size << "," << elem << "," << cost << "," << opt.costNs << "," << policy << "," << chunkName << "," << workers << "," << opt.threads << ","
+            << opt.repeats << "," << median << "," << percentile(times, 10) << "," << percentile(times, 90) << ","
+            << *std::min_element(times.begin(), times.end()) << "," << *std::max_element(times.begin(), times.end()) << ","
+            << (median > 0 ? size / (median / 1000.0) : 0) << std::endl;
+        std::cerr << "size " << size << " elem " << elem << " " << cost << " " << policy << " chunk " << chunkName << " workers " << workers
+                  << ": median " << median << " ms" << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,350 @@
+#include <DMap.hpp>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <random>
+
+/*
+    Microbenchmarks of the fixed costs of the network path:
+        - encode/decode of a Dtask<T> with cereal PortableBinary vs. a raw memcpy of the elements, across element sizes
+        - serialization round trip through a std::stringstream vs. through dataBuffer (the zero copy buffer of the receiver)
+        - compression and decompression of a payload with the frame codec (DMapCompress.hpp), on repetitive and on random data,
+          and its round trip on payloads of random length (the program fails if any payload does not come back intact)
+        - encode/decode of rows of 3 ints with cereal vs. the columnar encoding (DMapColumnar.hpp), checking that the rows come back
+        - ping-pong (latency) and streaming with a window of messages in flight (bandwidth) through a sender/receiver pair,
+          over the transport the program is compiled with:
+
+        $ make LOCAL=1 tests/microbench && ./tests/microbench      (AF_LOCAL)
+        $ make tests/microbench && ./tests/microbench               (TCP on localhost)
+
+    Every measure is repeated, the table reports the percentiles of the time per operation and the GB/s at the median; a stream
+    is sampled in BATCHES batches of messages, each giving the average time per message while the window is full.
+*/
+
+#define REPEATS 200
+#define PAYLOAD (1 << 20)   // bytes of the serialized tasks
+#define WINDOW 16           // messages in flight when streaming
+#define BATCHES 20          // samples of a stream: time per message over each batch of messages received
+
+using clk = std::chrono::steady_clock;
+
+template<size_t N>
+struct item {
+    std::array<char, N> payload;
+
+    template <class Archive>
+    void serialize(Archive& ar){
+        ar(payload);
+    }
+};
+
+/*
+    One table row: percentiles of the samples (ns) and the GB/s moving bytes at the median
+*/
+void report(const std::string& name, std::vector<double> ns, size_t bytes){
+    std::sort(ns.begin(), ns.end());
+    auto pct = [&](double p){ return ns[std::min(ns.size() - 1, (size_t)(p / 100.0 * ns.size()))]; };
+    std::cout << std::left << std::setw(44) << name << std::right << std::fixed << std::setprecision(1)
+              << std::setw(12) << pct(50) / 1e3 << std::setw(12) << pct(90) / 1e3 << std::setw(12) << pct(99) / 1e3
+              << std::setw(10) << std::setprecision(2) << bytes / pct(50) << std::endl;
+}
+
+template<typename F>
+std::vector<double> measure(size_t repeats, F f){
+    std::vector<double> ns;
+    for (size_t r = 0; r < repeats; r++){
+        auto start = clk::now();
+        f();
+        ns.push_back(std::chrono::duration<double, std::nano>(clk::now() - start).count());
+    }
+    return ns;
+}
+
+/*
+    Row of 3 ints sent in the columnar encoding, same layout as std::array<int, 3> which cereal sends element by element
+*/
+struct row {
+    std::array<int, 3> v;
+};
+template<> struct DColumnar<row> : DColumns<int> {};
+
+/*
+    PortableBinary vs. raw encode/decode of a task of PAYLOAD bytes made of N byte elements
+*/
+template<size_t N>
+void serialization(){
+    Dtask<item<N>> task(0, 0, PAYLOAD / N);
+    task.data.resize(PAYLOAD / N);
+    std::string tag = "elements of " + std::to_string(N) + " B";
+
+    report("cereal encode, " + tag, measure(REPEATS, [&]{
+        dataBuffer buff;
+        std::ostream oss(&buff);
+        cereal::PortableBinaryOutputArchive oarchive(oss);
+        oarchive << task;
+    }), PAYLOAD);
+
+    dataBuffer encoded;
+    {
+        std::ostream oss(&encoded);
+        cereal::PortableBinaryOutputArchive oarchive(oss);
+        oarchive << task;
+    }
+    std::string bytes(encoded.getPtr(), encoded.getLen());
+    report("cereal decode, " + tag, measure(REPEATS, [&]{
+        dataBuffer buff(bytes.data(), bytes.size());
+        std::istream iss(&buff);
+        cereal::PortableBinaryInputArchive iarchive(iss);
+        Dtask<item<N>> out;
+        iarchive >> out;
+    }), PAYLOAD);
+
+    std::vector<char> raw(3 * sizeof(size_t) + PAYLOAD);
+    report("raw encode, " + tag, measure(REPEATS, [&]{
+        size_t header[3] = {task.id_worker, task.begin_i, task.end_i};
+        std::memcpy(raw.data(), header, sizeof(header));
+        std::memcpy(raw.data() + sizeof(header), task.data.data(), task.data.size() * N);
+    }), PAYLOAD);
+    report("raw decode, " + tag, measure(REPEATS, [&]{
+        size_t header[3];
+        std::memcpy(header, raw.data(), sizeof(header));
+        Dtask<item<N>> out(header[0], header[1], header[2]);
+        out.data.resize(header[2] - header[1]);
+        std::memcpy(out.data.data(), raw.data() + sizeof(header), out.data.size() * N);
+    }), PAYLOAD);
+}
+
+/*
+    Encode + decode of a task through a std::stringstream (two copies of the bytes) vs. through dataBuffer as sender and receiver do
+*/
+void bufferRoundTrip(){
+    Dtask<char> task(0, 0, PAYLOAD);
+    task.data.resize(PAYLOAD);
+
+    report("stringstream round trip", measure(REPEATS, [&]{
+        std::stringstream ss;
+        { cereal::PortableBinaryOutputArchive oarchive(ss); oarchive << task; }
+        std::string bytes = ss.str();
+        std::stringstream in(bytes);
+        cereal::PortableBinaryInputArchive iarchive(in);
+        Dtask<char> out;
+        iarchive >> out;
+    }), PAYLOAD);
+
+    report("dataBuffer round trip", measure(REPEATS, [&]{
+        dataBuffer buff;
+        std::ostream oss(&buff);
+        { cereal::PortableBinaryOutputArchive oarchive(oss); oarchive << task; }
+        char* bytes = new char[buff.getLen()];
+        std::memcpy(bytes, buff.getPtr(), buff.getLen()); // what the receiver reads from the socket
+        dataBuffer in(bytes, buff.getLen(), true);
+        std::istream iss(&in);
+        cereal::PortableBinaryInputArchive iarchive(iss);
+        Dtask<char> out;
+        iarchive >> out;
+    }), PAYLOAD);
+}
+
+/*
+    DCompress/DDecompress of PAYLOAD bytes of 64 bit integers, either repeating every 100 values or random. False if the round trip fails.
+*/
+bool codec(bool repetitive){
+    std::vector<char> plain(PAYLOAD), packed(PAYLOAD), out(PAYLOAD);
+    for (size_t i = 0; i < PAYLOAD / sizeof(uint64_t); i++){
+        uint64_t v = repetitive ? i % 100 : i * 0x9E3779B97F4A7C15ull;
+        std::memcpy(plain.data() + i * sizeof(v), &v, sizeof(v));
+    }
+    std::string tag = repetitive ? "repetitive" : "random";
+    size_t len = 0;
+    report("compress, " + tag, measure(REPEATS, [&]{ len = DCompress(plain.data(), PAYLOAD, packed.data(), PAYLOAD); }), PAYLOAD);
+    if (!len){
+        std::cout << "decompress, " << tag << ": incompressible, sent as is" << std::endl;
+        return true;
+    }
+    bool decoded = true;
+    report("decompress, " + tag + " (ratio " + std::to_string((double)len / PAYLOAD).substr(0, 5) + ")",
+           measure(REPEATS, [&]{ decoded = DDecompress(packed.data(), len, out.data(), PAYLOAD) && decoded; }), PAYLOAD);
+    if (!decoded || out != plain){
+        std::cerr << "Codec round trip failed on the " << tag << " payload" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/*
+    DCompress/DDecompress round trip of payloads of random length (up to 256 KiB, plus the lengths around the token nibbles), made of
+    random bytes or of random runs repeated at random distances. Both with the capacity of the frames (the payload size, so
+    incompressible payloads are refused) and with room for an expanded output, which exercises long literal runs.
+*/
+bool codecPayloads(){
+    std::mt19937_64 rng(42);
+    std::vector<size_t> lengths = {0, 1, 3, 4, 5, 14, 15, 16, 18, 19, 20, 270, 271, 65535, 65536, 65537};
+    for (int i = 0; i < 40; i++)
+        lengths.push_back(rng() % (256 << 10));
+
+    for (size_t n : lengths)
+        for (bool incompressible : {false, true}){
+            std::vector<char> plain(n);
+            for (size_t i = 0; i < n; ){
+                size_t run = 1 + rng() % 64, back = 1 + rng() % 70000; // some runs are beyond the reach of the matches
+                for (size_t j = 0; j < run && i < n; j++, i++)
+                    plain[i] = incompressible || i < back ? (char)rng() : plain[i - back];
+            }
+            for (size_t cap : {n, n + n / 255 + 16}){
+                std::vector<char> packed(cap), out(n);
+                size_t len = DCompress(plain.data(), n, packed.data(), cap);
+                if (len > cap || (len && (!DDecompress(packed.data(), len, out.data(), n) || out != plain))){
+                    std::cerr << "Codec round trip failed on " << n << (incompressible ? " random" : " repetitive") << " bytes, capacity "
+                              << cap << std::endl;
+                    return false;
+                }
+            }
+        }
+    std::cout << "codec round trip of " << lengths.size() * 4 << " payloads: OK" << std::endl;
+    return true;
+}
+
+/*
+    Rows of a matrix (a sequence number, a small value, a value growing by 3) with cereal and with the columnar encoding.
+    False if a decoded task differs from the encoded one.
+*/
+bool columnarRows(){
+    size_t n = PAYLOAD / sizeof(row);
+    Dtask<std::array<int, 3>> plain(0, 0, n);
+    Dtask<row> columns(0, 0, n);
+    plain.data.resize(n);
+    columns.data.resize(n);
+    for (size_t i = 0; i < n; i++){
+        plain.data[i] = {(int)i, (int)(i % 10), (int)(3 * i)};
+        columns.data[i].v = plain.data[i];
+    }
+
+    auto encoded = [](auto& task){
+        auto buff = std::make_shared<dataBuffer>();
+        std::ostream oss(buff.get());
+        cereal::PortableBinaryOutputArchive oarchive(oss);
+        oarchive << task;
+        return std::string(buff->getPtr(), buff->getLen());
+    };
+    auto rows = [&](const std::string& name, auto& task){
+        typedef typename std::remove_reference<decltype(task)>::type task_t;
+        std::string bytes = encoded(task);
+        auto decode = [&](task_t& out){
+            dataBuffer buff(bytes.data(), bytes.size());
+            std::istream iss(&buff);
+            cereal::PortableBinaryInputArchive iarchive(iss);
+            iarchive >> out;
+        };
+        task_t check;
+        decode(check);
+        if (check.data.size() != task.data.size() || std::memcmp(check.data.data(), task.data.data(), task.data.size() * sizeof(task.data[0]))){
+            std::cerr << name << " decode does not give back the encoded rows" << std::endl;
+            return false;
+        }
+        report(name + " encode (" + std::to_string(bytes.size() / 1024) + " KiB)", measure(REPEATS, [&]{ encoded(task); }), PAYLOAD);
+        report(name + " decode", measure(REPEATS, [&]{
+            task_t out;
+            decode(out);
+        }), PAYLOAD);
+        return true;
+    };
+    bool ok = rows("cereal rows of 3 int,", plain);
+    return rows("columnar rows of 3 int,", columns) && ok;
+}
+
+/*
+    Node driving the transport test on the initiating side: it sends a message when the receiver connects and a new one for every
+    message coming back, keeping window messages in flight, and times each round trip and each batch of messages received
+*/
+struct driver : public ff::ff_node_t<Dtask<char>> {
+    size_t size, messages, window, sent = 0, received = 0;
+    std::vector<clk::time_point> sentAt;
+    std::vector<double> rtt, perMessage;
+    clk::time_point mark;
+
+    driver(size_t _size, size_t _messages, size_t _window) : size(_size), messages(_messages), window(_window), sentAt(_messages) {}
+
+    void send(){
+        Dtask<char>* task = new Dtask<char>(0, sent, sent + 1);
+        task->data.resize(size);
+        sentAt[sent++] = clk::now();
+        this->ff_send_out(task);
+    }
+
+    Dtask<char>* svc(Dtask<char>* in){
+        if (in->end_i == 0){ // boot, the other side connected
+            delete in;
+            mark = clk::now();
+            while (sent < std::min(window, messages))
+                send();
+            return this->GO_ON;
+        }
+
+        rtt.push_back(std::chrono::duration<double, std::nano>(clk::now() - sentAt[in->begin_i]).count());
+        delete in;
+        size_t batch = std::max<size_t>(1, messages / BATCHES);
+        if (++received % batch == 0){
+            clk::time_point now = clk::now();
+            perMessage.push_back(std::chrono::duration<double, std::nano>(now - mark).count() / batch);
+            mark = now;
+        }
+        if (received == messages)
+            return this->EOS;
+        if (sent < messages)
+            send();
+        return this->GO_ON;
+    }
+};
+
+/*
+    Echo side (receiver -> sender, i.e. a worker without computation) and initiating side (receiver -> driver -> sender, i.e. a master)
+*/
+void transport(const std::string& name, const std::string& addrA, const std::string& addrB, size_t size, size_t messages, size_t window){
+    ff::ff_pipeline echo, initiator;
+    echo.add_stage(new receiver<char>(addrB, 1, false), true);
+    echo.add_stage(new sender<char>(0, addrA), true);
+
+    driver* d = new driver(size, messages, window);
+    initiator.add_stage(new receiver<char>(addrA, 1, true), true);
+    initiator.add_stage(d, true);
+    initiator.add_stage(new sender<char>(0, std::vector<std::string>{addrB}), true);
+
+    if (initiator.run() < 0 || echo.run() < 0 || initiator.wait() < 0 || echo.wait() < 0){
+        std::cerr << "Error running " << name << std::endl;
+        return;
+    }
+
+    if (window == 1)
+        report(name, d->rtt, 2 * size);
+    else
+        report(name, d->perMessage, size);
+}
+
+int main(){
+    #ifdef LOCAL
+        std::string a = "/tmp/dmap_microbench_a", b = "/tmp/dmap_microbench_b", transportName = "AF_LOCAL";
+    #else
+        std::string a = "127.0.0.1:18401", b = "127.0.0.1:18402", transportName = "TCP";
+    #endif
+
+    std::cout << std::left << std::setw(44) << "benchmark" << std::right << std::setw(12) << "p50 (us)" << std::setw(12) << "p90 (us)"
+              << std::setw(12) << "p99 (us)" << std::setw(10) << "GB/s" << std::endl;
+
+    serialization<8>();
+    serialization<64>();
+    serialization<512>();
+    bufferRoundTrip();
+    bool ok = codec(true);
+    ok = codec(false) && ok;
+    ok = codecPayloads() && ok;
+    ok = columnarRows() && ok;
+
+    for (size_t size : {64, 4096, 65536, 1 << 20}){
+        transport(transportName + " ping-pong " + std::to_string(size) + " B", a, b, size, size < 65536 ? 2000 : 200, 1);
+        transport(transportName + " stream " + std::to_string(size) + " B", a, b, size, size < 65536 ? 20000 : 1000, WINDOW);
+    }
+    return ok ? 0 : 1;
+}
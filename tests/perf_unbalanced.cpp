@@ -7,6 +7,7 @@
 #define INPUT_SIZE 100000
 #define THREADS 40
 #define CHUNK_SIZE 128   // 0 => static sxcheduling, dynamic scheduling otherwise
+#define COST_HINT 0      // 1 => static scheduling on the known cost of the items (see DMap::cost_hint), CHUNK_SIZE is not used
 
 void active_delay(int msecs) {
   // read current time
@@ -41,7 +42,13 @@ int main(int argc, char*argv[]){
     }
 
         // note the abolute primitive in lambda function and a scaling of 1000 which results in items of computation time limited to 50ms
-    if (DMap::map(exec, [](int& i){active_delay(abs(i)/100); return i;}, input.begin(), input.end(), output.begin(), CHUNK_SIZE, (void*) nullptr, THREADS) < 0){
+    auto work = [](int& i){active_delay(abs(i)/100); return i;};
+    #if COST_HINT
+        int result = DMap::map(exec, work, input.begin(), input.end(), output.begin(), DMap::cost_hint([](const int& i){ return abs(i)/100; }), (void*) nullptr, THREADS);
+    #else
+        int result = DMap::map(exec, work, input.begin(), input.end(), output.begin(), CHUNK_SIZE, (void*) nullptr, THREADS);
+    #endif
+    if (result < 0){
         std::cout << "ERROR" << std::endl;
         return 1;
     }
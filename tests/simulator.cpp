@@ -0,0 +1,220 @@
+#include <DMapPolicy.hpp>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <queue>
+#include <cmath>
+#include <stdexcept>
+
+/*
+    Discrete event simulator of a map: the scheduling policy of the master (DSchedulePolicy, the same code DMapMaster runs) drives
+    synthetic workers, so chunk size and preassign depth can be tuned on one machine. It needs neither FastFlow nor cereal:
+
+        $ g++ -std=c++17 -O3 -Isrc tests/simulator.cpp -o tests/simulator
+        $ ./tests/simulator --items 1000000 --cost heavy --speeds 1,1,1,0.5 --chunks 0,256,4096 --preassign 1,2,4
+
+    Model: the master handles one message at a time (master-us each), a message takes latency-us plus its bytes over the bandwidth,
+    a worker computes its chunks in arrival order at its speed (1 => cost-ns per item on average), and a failed worker stops
+    answering at the given time: its chunks are lost, since the master does not reschedule them.
+
+    Options (comma separated lists are swept):
+        --items        number of items                                         (default 1000000)
+        --cost         uniform, ramp (0 to 2x the mean), heavy (Pareto, alpha 1.5)   (default uniform)
+        --cost-ns      mean cost per item                                      (default 1000)
+        --item-bytes   bytes per item, each way                                (default 8)
+        --speeds       relative speed of each worker                           (default 1,1,1,1)
+        --latency-us   one way network latency                                 (default 50)
+        --bandwidth    network bandwidth, GB/s                                 (default 1)
+        --master-us    master time to handle a result and dispatch the next chunk   (default 5)
+        --fail         <worker>@<seconds>, worker failures                      (default none)
+        --chunks       chunk sizes, 0 => static scheduling, auto => CHUNK_AUTO,
+                       weighted => static scheduling on the exact item costs (DMap::cost_hint)   (default 0,256,1024,4096)
+        --preassign    chunks per worker at startup                            (default 1,2,4)
+        --overhead     overhead share targeted by auto                         (default 0.05)
+
+    With auto the preassign sweep does not apply, and the chunk column shows the size chosen at the end.
+*/
+
+#define WEIGHTED ((size_t)-2) // --chunks weighted
+
+struct model {
+    size_t items = 1000000, itemBytes = 8;
+    std::string cost = "uniform";
+    double costNs = 1000, latencyUs = 50, bandwidth = 1, masterUs = 5, overhead = 0.05;
+    std::vector<double> speeds = {1, 1, 1, 1};
+    std::vector<double> failAt; // per worker, seconds (infinity => never)
+    std::vector<size_t> chunks = {0, 256, 1024, 4096}, preassign = {1, 2, 4};
+};
+
+struct outcome {
+    double makespan = 0;           // seconds, up to the last result handled by the master
+    std::vector<double> busy;      // per worker, seconds computing
+    size_t messages = 0, lostItems = 0;
+    size_t chunk = 0, window = 0, retunes = 0; // with auto, the final choice
+};
+
+// same deterministic costs as tests/bench.cpp
+double itemCost(const std::string& dist, size_t i, size_t n, double mean){
+    if (dist == "ramp")
+        return 2.0 * mean * i / n;
+    if (dist == "heavy"){
+        double u = ((i * 2654435761u) % 1000003) / 1000003.0;
+        return std::min(mean / 3.0 * std::pow(1.0 - u, -1.0 / 1.5), 1000.0 * mean);
+    }
+    return mean;
+}
+
+/*
+    Run the map with the given policy parameters: events are chunks arriving at a worker and results arriving at the master
+*/
+outcome simulate(const model& m, const std::vector<double>& prefixCost, size_t chunk, size_t preassign){
+    struct event {
+        double time;
+        bool toMaster;
+        DSchedulePolicy::assignment a;
+        bool operator>(const event& o) const { return time > o.time; }
+    };
+    std::priority_queue<event, std::vector<event>, std::greater<event>> events;
+
+    size_t workers = m.speeds.size();
+    DSchedulePolicy policy(m.items, workers, chunk == WEIGHTED ? 0 : chunk, preassign, nullptr, true, 0, m.overhead);
+    if (chunk == WEIGHTED)
+        policy.setWeights(prefixCost);
+    outcome out;
+    out.busy.assign(workers, 0);
+    std::vector<double> busyUntil(workers, 0);
+    double masterFree = 0;
+    size_t done = 0;
+
+    auto transfer = [&](const DSchedulePolicy::assignment& a){
+        return m.latencyUs * 1e-6 + (a.end_i - a.begin_i) * m.itemBytes / (m.bandwidth * 1e9);
+    };
+    auto send = [&](double now, const DSchedulePolicy::assignment& a){
+        out.messages++;
+        events.push({now + transfer(a), false, a});
+    };
+
+    policy.start();
+    for (size_t w = 0; w < workers; w++)
+        for (const auto& a : policy.fill(w, 0))
+            send(0, a);
+
+    while (!events.empty()){
+        event e = events.top();
+        events.pop();
+        size_t w = e.a.worker;
+        size_t items = e.a.end_i - e.a.begin_i;
+
+        if (!e.toMaster){ // a chunk reaches its worker: computed after the ones already queued there
+            double start = std::max(e.time, busyUntil[w]);
+            double compute = (prefixCost[e.a.end_i] - prefixCost[e.a.begin_i]) * 1e-9 / m.speeds[w];
+            if (start + compute > m.failAt[w]){ // the worker fails before completing it
+                out.busy[w] += std::max(0.0, m.failAt[w] - start);
+                busyUntil[w] = m.failAt[w];
+                out.lostItems += items;
+                continue;
+            }
+            busyUntil[w] = start + compute;
+            out.busy[w] += compute;
+            out.messages++;
+            events.push({busyUntil[w] + transfer(e.a), true, e.a});
+            continue;
+        }
+
+        // a result reaches the master: handled in arrival order, then the worker gets its next chunk
+        masterFree = std::max(e.time, masterFree) + m.masterUs * 1e-6;
+        out.makespan = masterFree;
+        done += items;
+        DSchedulePolicy::assignment next;
+        policy.completed(w, e.a.begin_i, e.a.end_i, masterFree * 1e6);
+        while (policy.next(w, next, masterFree * 1e6))
+            send(masterFree, next);
+    }
+    out.lostItems = m.items - done;
+    out.chunk = policy.isAuto() ? policy.chunkSize() : chunk;
+    out.window = policy.inFlightWindow();
+    out.retunes = policy.retunes;
+    return out;
+}
+
+template<typename T>
+std::vector<T> parseList(const std::string& s){
+    std::vector<T> result;
+    std::stringstream ss(s);
+    std::string item;
+    while (getline(ss, item, ','))
+        if (item == "auto")
+            result.push_back((T)CHUNK_AUTO);
+        else if (item == "weighted")
+            result.push_back((T)WEIGHTED);
+        else if (!item.empty())
+            result.push_back((T)std::stod(item));
+    return result;
+}
+
+int main(int argc, char* argv[]){
+    model m;
+    std::vector<std::string> failures;
+    for (int i = 1; i + 1 < argc; i += 2){
+        std::string key(argv[i]), value(argv[i + 1]);
+        if (key == "--items") m.items = std::stoul(value);
+        else if (key == "--cost") m.cost = value;
+        else if (key == "--cost-ns") m.costNs = std::stod(value);
+        else if (key == "--item-bytes") m.itemBytes = std::stoul(value);
+        else if (key == "--speeds") m.speeds = parseList<double>(value);
+        else if (key == "--latency-us") m.latencyUs = std::stod(value);
+        else if (key == "--bandwidth") m.bandwidth = std::stod(value);
+        else if (key == "--master-us") m.masterUs = std::stod(value);
+        else if (key == "--fail") failures.push_back(value);
+        else if (key == "--chunks") m.chunks = parseList<size_t>(value);
+        else if (key == "--preassign") m.preassign = parseList<size_t>(value);
+        else if (key == "--overhead") m.overhead = std::stod(value);
+        else {
+            std::cerr << "Unknown option " << key << std::endl;
+            return 1;
+        }
+    }
+
+    m.failAt.assign(m.speeds.size(), INFINITY);
+    for (const std::string& f : failures){
+        size_t at = f.find('@'), w = 0;
+        double when = 0;
+        try {
+            if (at != std::string::npos){
+                w = std::stoul(f.substr(0, at));
+                when = std::stod(f.substr(at + 1));
+            }
+        } catch (const std::exception&){
+            at = std::string::npos;
+        }
+        if (at == std::string::npos || w >= m.speeds.size()){
+            std::cerr << "Invalid failure " << f << std::endl;
+            return 1;
+        }
+        m.failAt[w] = when;
+    }
+
+    std::vector<double> prefixCost(m.items + 1, 0);
+    for (size_t i = 0; i < m.items; i++)
+        prefixCost[i + 1] = prefixCost[i] + itemCost(m.cost, i, m.items, m.costNs);
+
+    std::cout << std::setw(11) << "chunk" << std::setw(11) << "preassign" << std::setw(15) << "makespan (ms)" << std::setw(12) << "idle avg %"
+              << std::setw(12) << "idle max %" << std::setw(11) << "messages" << std::setw(12) << "lost items" << std::endl;
+    for (size_t chunk : m.chunks)
+        for (size_t preassign : (chunk && chunk != CHUNK_AUTO && chunk != WEIGHTED ? m.preassign : std::vector<size_t>{1})){
+            outcome o = simulate(m, prefixCost, chunk, preassign);
+            double idleSum = 0, idleMax = 0;
+            for (double b : o.busy){
+                double idle = o.makespan > 0 ? 100.0 * (1 - b / o.makespan) : 0;
+                idleSum += idle;
+                idleMax = std::max(idleMax, idle);
+            }
+            std::string name = chunk == CHUNK_AUTO ? "auto " + std::to_string(o.chunk) : chunk == WEIGHTED ? "weighted" : std::to_string(chunk);
+            std::string depth = chunk == CHUNK_AUTO ? std::to_string(o.window) : std::to_string(preassign);
+            std::cout << std::fixed << std::setprecision(2) << std::setw(11) << name << std::setw(11) << depth << std::setw(15) << o.makespan * 1e3
+                      << std::setw(12) << idleSum / o.busy.size() << std::setw(12) << idleMax << std::setw(11) << o.messages << std::setw(12) << o.lostItems << std::endl;
+        }
+    return 0;
+}
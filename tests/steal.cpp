@@ -0,0 +1,71 @@
+#include <DMap.hpp>
+#include <iostream>
+#include <numeric>
+#include <algorithm>
+#include <unistd.h>
+
+#define INPUT_SIZE 40000
+#define SLOW_ITEMS (INPUT_SIZE / 4) // the first items are slow, so the worker holding them is robbed by the others
+#define THREADS 1
+#define CHUNK_SIZE 500              // stealing granularity
+
+/*
+    Check of the work stealing mode: every item must be computed exactly once, and the block of the first worker must be (partly)
+    computed by the other workers. Run it with at least 2 workers, e.g.
+
+        $ make LOCAL=1 tests/steal && ./scripts/runExec_local.sh ./tests/steal 3
+
+    With the built-in launcher (./tests/steal local 3) stealing is not supported and the master schedules the map.
+*/
+
+struct result {
+    long value;
+    int pid; // process that computed the item
+
+    template <class Archive>
+    void serialize(Archive& ar){
+        ar(value, pid);
+    }
+};
+
+int main(int argc, char*argv[]){
+    DMap::Exec exec(argc, argv);
+    exec.workStealing = true;
+    std::vector<long> input;
+    std::vector<result> output;
+
+    if (exec.isMaster){
+        input = std::vector<long>(INPUT_SIZE);
+        output = std::vector<result>(INPUT_SIZE);
+        std::iota(input.begin(), input.end(), 0);
+    }
+
+    auto work = [](long& x) -> result {
+        if (x < SLOW_ITEMS) usleep(20);
+        return {2 * x, getpid()};
+    };
+    DMap::map(exec, work, input.begin(), input.end(), output.begin(), CHUNK_SIZE, (void*) nullptr, THREADS);
+
+    if (exec.isMaster){
+        for (size_t i = 0; i < output.size(); i++)
+            if (output[i].value != 2 * (long)i){
+                std::cout << "Wrong result at " << i << std::endl;
+                return 1;
+            }
+
+        // items of the first block computed by a process other than its owner
+        size_t workers = exec.workers_addrs.size();
+        size_t firstBlock = workers ? (INPUT_SIZE + workers - 1) / workers : 0;
+        size_t stolen = std::count_if(output.begin(), output.begin() + firstBlock, [&](const result& r){ return r.pid != output[0].pid; });
+        std::cout << "Items stolen from the first worker: " << stolen << std::endl;
+
+        bool stealing = workers > 1 && std::none_of(exec.workers_addrs.begin(), exec.workers_addrs.end(), isPreconnected);
+        if (stealing && !stolen){
+            std::cout << "No item was stolen" << std::endl;
+            return 1;
+        }
+        std::cout << "Results are correct" << std::endl;
+    }
+
+    return 0;
+}